@@ -1,21 +1,42 @@
 ﻿#pragma once
 #include <SFML/Graphics.hpp>
 #include <memory>
+#include <chrono>
+#include <future>
 #include "Scene.h"
+#include "SceneSnapshot.h"
 #include "RenderStrategy.h"
+#include "OfflineRenderer.h"
+#include "RenderServer.h"
+#include "Benchmark.h"
+#include "Microbenchmarks.h"
+#include "StressScene.h"
+#include "RegressionTest.h"
+#include "PerfStats.h"
+#include "Trace.h"
 #include "ImGuiManager.h"
 #include "CornellRoom.h"
 #include "OBJLoader.h"
 
 class Application {
 public:
-    Application() {
+    // headless: the scene only, no window or UI, for runServer() and the benchmarks
+    explicit Application(bool headless = false) {
+        if (headless) {
+            setupScene();
+            return;
+        }
+
         window.create(sf::VideoMode({ 1200,800 }), "3D Renderer");
 
         setupScene();
         setupRendering();
 
         imguiManager = std::make_unique<ImGuiManager>(window, *scene, cornellRoom.get());
+        imguiManager->setRayTracingSettings(&rayTracingSettings);
+        imguiManager->setOfflineRenderSettings(&offlineSettings);
+        imguiManager->setPerfStats(&perfStats);
+        perfStats.meshBytes = meshMemoryBytes();
     }
 
     void run() {
@@ -24,10 +45,98 @@ public:
         while (window.isOpen()) {
             float deltaTime = clock.restart().asSeconds();
 
+            TRACE_SCOPE("frame");
+            FrameTimings timings;
+            PhaseTimer phase;
+
             handleEvents();
+            timings.events = phase.lap();
             update(deltaTime);
-            render();
+            timings.update = phase.lap();
+            render(timings, phase);
+
+            perfStats.addFrame(timings);
+        }
+    }
+
+    int runServer(const std::string& socketPath, bool hardwareCounters = false) {
+        rayTracer.settings.hardwareCounters = hardwareCounters;
+        RenderServer server(*scene, rayTracer);
+        return server.run(socketPath) ? 0 : 1;
+    }
+
+    // The standard scenes, each rebuilt from setupScene() so earlier edits cannot leak in
+    int runBenchmark(const BenchmarkSettings& settings) {
+        Benchmark benchmark(settings);
+        for (const char* name : { "cornell", "mirror-walls", "glass-spheres", "large-obj" }) {
+            setupScene();
+            benchmark.run(setupBenchmarkScene(name, settings.objPath), *scene);
+        }
+
+        for (size_t primitives : settings.stressSizes) {
+            setupScene();
+            StressSceneSettings stress;
+            stress.primitives = primitives;
+            stress.roomSize = cornellRoom->getRoomSize();
+            StressScene::populate(*scene, stress);
+            benchmark.run("stress-" + std::to_string(primitives), *scene);
+        }
+        return benchmark.finish();
+    }
+
+    // The benchmark scenes with Whitted, antialiased and path traced settings
+    int runRegression(const RegressionSettings& settings) {
+        RegressionTest test(settings);
+
+        RayTracingSettings antialiased;
+        antialiased.antialiasingSamples = 4;
+        RayTracingSettings pathTraced;
+        pathTraced.integrator = Integrator::PathTracing;
+        pathTraced.samplesPerFrame = 4;
+
+        for (const char* name : { "cornell", "mirror-walls", "glass-spheres" }) {
+            setupScene();
+            setupBenchmarkScene(name, "");
+            test.run(name, *scene, RayTracingSettings{});
+            if (std::string(name) != "cornell") continue;
+
+            test.run("cornell-aa4", *scene, antialiased);
+            test.run("cornell-path4", *scene, pathTraced);
+
+            std::vector<Camera> views(3, *scene->getCamera());
+            views[1].position += glm::vec3(6.0f, 3.0f, 0.0f);
+            views[2].position -= glm::vec3(6.0f, 0.0f, 10.0f);
+            views[2].fov = 60.0f;
+            test.runViews("cornell-views", *scene, antialiased, views);
+            RayTracingSettings pathTracedViews = pathTraced;
+            pathTracedViews.targetSamples = 4;
+            test.runViews("cornell-path4-views", *scene, pathTracedViews, views);
+        }
+        return test.finish();
+    }
+
+    // An image file of the default scene, or of a scene file, without a window. With a views
+    // file, one image per camera listed in it from a single scene build.
+    int runOfflineRender(const OfflineRenderSettings& settings, const RayTracingSettings& tracerSettings, const std::string& scenePath, const std::string& viewsPath = "") {
+        if (!scenePath.empty() && !SceneFile::load(scenePath, *scene)) return 1;
+
+        RayTracingStrategy tracer;
+        tracer.settings = tracerSettings;
+        if (!viewsPath.empty()) {
+            std::vector<Camera> cameras;
+            if (!OfflineRenderer::readViews(viewsPath, *scene->getCamera(), cameras)) return 1;
+            return OfflineRenderer::renderViews(tracer, *scene, cameras, settings) ? 0 : 1;
         }
+        return OfflineRenderer::render(tracer, *scene, settings, [](unsigned done, unsigned total) {
+            std::cout << "\rRows " << done << " / " << total << std::flush;
+            if (done == total) std::cout << std::endl;
+            }) ? 0 : 1;
+    }
+
+    int runMicrobenchmarks(const std::string& filter) {
+        RayTracingStrategy tracer;
+        Microbenchmarks::run(tracer, *scene, filter);
+        return 0;
     }
 
 private:
@@ -36,12 +145,26 @@ private:
     std::unique_ptr<Scene> scene;
     std::unique_ptr<CornellRoom> cornellRoom;
     std::unique_ptr<RenderStrategy> renderStrategy;
+    RayTracingStrategy rayTracer;
+    RayTracingSettings rayTracingSettings;  // edited by the UI, handed to rayTracer per render
+    SceneSnapshotter snapshotter;
+    OfflineRenderSettings offlineSettings;
+    std::future<bool> offlineJob;
+    PerfStats perfStats;
 
     bool showRayTracingResult = false;
+    FrameBuffer rayTracingFrame;
     std::unique_ptr<sf::Texture> rayTracingTexture;
     bool needsRayTracingRender = false;
 
+    // the interactive render in flight; only its thread touches rayTracer and rayTracingFrame
+    // until it is done. Declared after them, so it is waited for before they are destroyed.
+    std::future<void> rayTracingJob;
+    std::chrono::steady_clock::time_point rayTracingStart;
+    RayCounters::Totals rayTracingRaysBefore;
+
     void handleEvents() {
+        TRACE_SCOPE("events");
         while (auto event = window.pollEvent()) {
             imguiManager->processEvent(*event);
 
@@ -58,10 +181,22 @@ private:
             std::cout << "Starting one-time ray tracing..." << std::endl;
             showRayTracingResult = true;
             needsRayTracingRender = true;
+            if (rayTracingJob.valid()) rayTracingJob.get();
+            rayTracer.resetAccumulation();
             imguiManager->setShowRayTracingResult(true);
             imguiManager->resetRenderFlags();
         }
 
+        if (imguiManager->shouldRenderOffline()) {
+            if (offlineJob.valid() && offlineJob.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                std::cout << "An offline render is still running" << std::endl;
+            }
+            else {
+                startOfflineRender();
+            }
+            imguiManager->resetRenderFlags();
+        }
+
         if (imguiManager->shouldReturnToEditing() && showRayTracingResult) {
             std::cout << "Returning to wireframe editing..." << std::endl;
             showRayTracingResult = false;
@@ -72,6 +207,7 @@ private:
     }
 
     void update(float deltaTime) {
+        TRACE_SCOPE("update");
         imguiManager->update(deltaTime);
 
         if (scene) {
@@ -79,44 +215,142 @@ private:
         }
     }
 
-    void render() {
-        window.clear(sf::Color::Black);
+    // milliseconds since the previous lap
+    struct PhaseTimer {
+        std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
 
-        if (showRayTracingResult) {
-            if (needsRayTracingRender) {
-                renderRayTracingOnce();
-                needsRayTracingRender = false;
-            }
+        float lap() {
+            auto now = std::chrono::steady_clock::now();
+            float ms = std::chrono::duration<float, std::milli>(now - last).count();
+            last = now;
+            return ms;
+        }
+    };
 
-            if (rayTracingTexture) {
-                sf::Sprite sprite(*rayTracingTexture);
-                window.draw(sprite);
+    void render(FrameTimings& timings, PhaseTimer& phase) {
+        {
+            TRACE_SCOPE("draw");
+            window.clear(sf::Color::Black);
+
+            if (showRayTracingResult) {
+                if (rayTracingJob.valid()) {
+                    finishRayTracing();
+                }
+                else if (needsRayTracingRender) {
+                    startRayTracing();
+                }
+
+                if (rayTracingTexture) {
+                    sf::Sprite sprite(*rayTracingTexture);
+                    window.draw(sprite);
+                }
             }
-        }
-        else {
-            if (renderStrategy && scene) {
-                renderStrategy->render(window, *scene);
+            else {
+                if (renderStrategy && scene) {
+                    renderStrategy->render(window, *scene);
+                }
             }
         }
+        timings.draw = phase.lap();
 
-        imguiManager->showSceneEditor();
-        imguiManager->render();
+        {
+            TRACE_SCOPE("imgui");
+            imguiManager->showSceneEditor();
+            imguiManager->showPerformanceWindow();
+            imguiManager->render();
+        }
+        timings.imgui = phase.lap();
 
-        window.display();
+        {
+            TRACE_SCOPE("present");
+            window.display();
+        }
+        timings.present = phase.lap();
     }
 
-    void renderRayTracingOnce() {
-        std::cout << "Performing one-time ray tracing render..." << std::endl;
+    // Renders a snapshot of the scene on a thread of its own with its own tracer, so editing
+    // and the interactive view carry on meanwhile
+    void startOfflineRender() {
+        std::cout << "Starting offline render " << offlineSettings.width << "x" << offlineSettings.height << "..." << std::endl;
+        std::shared_ptr<const SceneSnapshot> snapshot = snapshotter.capture(*scene);
+        const RayTracingSettings tracerSettings = rayTracingSettings;
+        const OfflineRenderSettings settings = offlineSettings;
+
+        offlineJob = std::async(std::launch::async, [snapshot, tracerSettings, settings]() {
+            RayTracingStrategy tracer;
+            tracer.settings = tracerSettings;
+            return OfflineRenderer::render(tracer, snapshot->scene(), settings, [](unsigned done, unsigned total) {
+                std::cout << "\rRows " << done << " / " << total << std::flush;
+                if (done == total) std::cout << std::endl;
+                });
+            });
+    }
 
-        RayTracingStrategy rayTracer;
+    size_t meshMemoryBytes() const {
+        size_t bytes = 0;
+        for (auto* mesh : scene->getAllMeshes()) bytes += sizeof(Mesh) + mesh->memoryBytes();
+        return bytes;
+    }
 
-        sf::Image rayTracedImage = sf::Image(sf::Vector2u(window.getSize().x, window.getSize().y), sf::Color::Black);
-        rayTracer.renderToImage(rayTracedImage, *scene);
+    // Traces a snapshot of the scene on a worker thread; the window keeps drawing the previous
+    // result and handling edits until finishRayTracing() finds the frame done
+    void startRayTracing() {
+        rayTracer.settings = rayTracingSettings;
+        const bool progressive = rayTracer.settings.integrator == Integrator::PathTracing;
+        if (!progressive || rayTracer.getAccumulatedSamples() == 0) {
+            std::cout << "Performing one-time ray tracing render..." << std::endl;
+        }
 
-        rayTracingTexture = std::make_unique<sf::Texture>();
-        rayTracingTexture->loadFromImage(rayTracedImage);
+        const sf::Vector2u size = window.getSize();
+        if (rayTracingFrame.width != size.x || rayTracingFrame.height != size.y) {
+            rayTracingFrame.resize(size.x, size.y);
+        }
+        rayTracingRaysBefore = RayCounters::read();
+        rayTracingStart = std::chrono::steady_clock::now();
+        std::shared_ptr<const SceneSnapshot> snapshot = snapshotter.capture(*scene);
 
-        std::cout << "Ray tracing completed and saved to texture." << std::endl;
+        rayTracingJob = std::async(std::launch::async, [this, snapshot]() {
+            rayTracer.render(rayTracingFrame, snapshot->scene());
+            });
+    }
+
+    // presents the frame of the worker once it is done
+    void finishRayTracing() {
+        if (rayTracingJob.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+        rayTracingJob.get();
+
+        const bool progressive = rayTracer.settings.integrator == Integrator::PathTracing;
+        needsRayTracingRender = rayTracer.needsMoreSamples();
+
+        perfStats.renderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - rayTracingStart).count();
+        perfStats.renderRays = RayCounters::read() - rayTracingRaysBefore;
+        perfStats.sceneBuildMs = rayTracer.getSceneBuildMs();
+        perfStats.tracerBytes = rayTracer.memoryBytes();
+        perfStats.meshBytes = meshMemoryBytes();
+
+        // the texture lives as long as the result view and is updated in place
+        const sf::Vector2u size(rayTracingFrame.width, rayTracingFrame.height);
+        if (!rayTracingTexture || rayTracingTexture->getSize() != size) {
+            rayTracingTexture = std::make_unique<sf::Texture>();
+            if (!rayTracingTexture->resize(size)) {
+                std::cerr << "Failed to create the ray tracing texture" << std::endl;
+                rayTracingTexture.reset();
+                return;
+            }
+        }
+        {
+            TRACE_SCOPE("texture upload");
+            rayTracingTexture->update(rayTracingFrame.pixels.data());
+        }
+
+        imguiManager->setRayTracingProgress(rayTracer.getAccumulatedSamples(), progressive);
+
+        if (!progressive) {
+            std::cout << "Ray tracing completed and saved to texture." << std::endl;
+        }
+        else if (!rayTracer.needsMoreSamples()) {
+            std::cout << "Path tracing finished at " << rayTracer.getAccumulatedSamples() << " samples per pixel." << std::endl;
+        }
     }
 
     void setupScene() {
@@ -143,6 +377,9 @@ private:
         lightNode->mesh = createLightMesh();
         lightNode->mesh->position = glm::vec3(0, 7.4f, 0);
         lightNode->mesh->material.diffuseColor = glm::vec3(1.0f, 1.0f, 0.8f);
+        lightNode->mesh->material.isEmissive = true;
+        lightNode->mesh->material.emissionColor = lightNode->light->color;
+        lightNode->mesh->material.emissionStrength = lightNode->light->intensity;
 
         scene->addLight(lightNode);
     }
@@ -218,6 +455,55 @@ private:
     }
 
 
+    // Returns the name the results are recorded under, which differs from name when a stand-in
+    // scene was used
+    std::string setupBenchmarkScene(const std::string& name, const std::string& objPath) {
+        if (name == "mirror-walls") {
+            cornellRoom->setWallReflectivity(CornellRoom::LEFT, 0.8f);
+            cornellRoom->setWallReflectivity(CornellRoom::RIGHT, 0.8f);
+            cornellRoom->setWallReflectivity(CornellRoom::BACK, 0.8f);
+        }
+        else if (name == "glass-spheres") {
+            for (auto* mesh : scene->getAllMeshes()) {
+                if (mesh->name.find("Sphere") == std::string::npos) continue;
+                mesh->material.diffuseColor = glm::vec3(0.95f, 0.97f, 1.0f);
+                mesh->material.isTransparent = true;
+                mesh->material.transparency = 0.9f;
+                mesh->material.refractiveIndex = 1.5f;
+            }
+        }
+        else if (name == "large-obj") {
+            // a generated mesh stands in when the model is missing, under a name of its own so
+            // it is never compared with runs of the real model
+            std::string recorded = name;
+            Mesh large = OBJLoader::loadFromFile(objPath);
+            if (large.faces.empty()) {
+                recorded = "large-obj-fallback-sphere";
+                std::cerr << "No model at " << objPath << ", benchmarking a generated 2k triangle mesh as " << recorded << std::endl;
+                large = Mesh::createSphereUV(1.0f, 24, 48);
+            }
+
+            glm::vec3 lo(std::numeric_limits<float>::max());
+            glm::vec3 hi(-std::numeric_limits<float>::max());
+            for (const auto& face : large.faces) {
+                for (const auto& v : face.vertices) {
+                    lo = glm::min(lo, v.position);
+                    hi = glm::max(hi, v.position);
+                }
+            }
+            const float extent = std::max(1e-4f, std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z)));
+
+            auto n = scene->getRoot()->createChild("LargeModel");
+            n->mesh = std::make_unique<Mesh>(large);
+            n->mesh->name = "LargeModel";
+            n->mesh->scale = glm::vec3(5.0f / extent);
+            n->mesh->position = glm::vec3(0.0f, -2.5f, 3.0f) - (lo + hi) * 0.5f * (5.0f / extent);
+            n->mesh->material.diffuseColor = glm::vec3(0.8f, 0.75f, 0.7f);
+            return recorded;
+        }
+        return name;
+    }
+
     std::unique_ptr<Mesh> createLightMesh() {
         auto mesh = std::make_unique<Mesh>(Mesh::createLightBox(6.0f, 0.15f, 6.0f));
         mesh->name = "LightCapsule";
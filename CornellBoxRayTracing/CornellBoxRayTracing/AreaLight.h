@@ -0,0 +1,94 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "Mesh.h"
+
+// World-space triangles of an emissive mesh, sampled in proportion to area
+struct AreaLight {
+    struct Triangle {
+        glm::vec3 v0{ 0.0f };
+        glm::vec3 e1{ 0.0f };
+        glm::vec3 e2{ 0.0f };
+        glm::vec3 normal{ 0.0f, 1.0f, 0.0f };
+        float area = 0.0f;
+    };
+
+    std::vector<Triangle> triangles;
+    std::vector<float> areaCdf;
+    glm::vec3 radiance{ 0.0f };
+    float totalArea = 0.0f;
+
+    size_t memoryBytes() const {
+        return triangles.capacity() * sizeof(Triangle) + areaCdf.capacity() * sizeof(float);
+    }
+
+    void build(const Mesh& mesh, const glm::mat4& model) {
+        triangles.clear();
+        totalArea = 0.0f;
+        radiance = mesh.material.emissionColor * mesh.material.emissionStrength;
+
+        for (const auto& face : mesh.geometry()) {
+            const size_t n = face.vertices.size();
+            if (n < 3) continue;
+
+            glm::vec3 p0 = glm::vec3(model * glm::vec4(face.vertices[0].position, 1.0f));
+            for (size_t i = 1; i + 1 < n; ++i) {
+                glm::vec3 p1 = glm::vec3(model * glm::vec4(face.vertices[i].position, 1.0f));
+                glm::vec3 p2 = glm::vec3(model * glm::vec4(face.vertices[i + 1].position, 1.0f));
+
+                Triangle t;
+                t.v0 = p0;
+                t.e1 = p1 - p0;
+                t.e2 = p2 - p0;
+                glm::vec3 c = glm::cross(t.e1, t.e2);
+                float len = glm::length(c);
+                if (len <= 1e-12f) continue;
+
+                t.normal = c / len;
+                t.area = 0.5f * len;
+                totalArea += t.area;
+                triangles.push_back(t);
+            }
+        }
+
+        areaCdf.resize(triangles.size());
+        float sum = 0.0f;
+        for (size_t i = 0; i < triangles.size(); ++i) {
+            sum += triangles[i].area;
+            areaCdf[i] = totalArea > 0.0f ? sum / totalArea : 0.0f;
+        }
+    }
+
+    // Fills cdf over the triangles whose front side faces p; false when none do
+    bool facingCdf(const glm::vec3& p, std::vector<float>& cdf) const {
+        cdf.resize(triangles.size());
+
+        float sum = 0.0f;
+        for (size_t i = 0; i < triangles.size(); ++i) {
+            const Triangle& t = triangles[i];
+            if (glm::dot(t.normal, p - t.v0) > 0.0f) sum += t.area;
+            cdf[i] = sum;
+        }
+
+        if (sum <= 0.0f) return false;
+        for (auto& c : cdf) c /= sum;
+        return true;
+    }
+
+    glm::vec3 samplePoint(const std::vector<float>& cdf, float u1, float u2, size_t* triangleIndex = nullptr) const {
+        size_t i = std::upper_bound(cdf.begin(), cdf.end(), u1) - cdf.begin();
+        i = std::min(i, triangles.size() - 1);
+
+        float lo = (i == 0) ? 0.0f : cdf[i - 1];
+        float width = cdf[i] - lo;
+        float u = width > 0.0f ? std::clamp((u1 - lo) / width, 0.0f, 1.0f) : 0.5f;
+
+        if (triangleIndex) *triangleIndex = i;
+
+        const Triangle& t = triangles[i];
+        float su = std::sqrt(u);
+        return t.v0 + t.e1 * (su * (1.0f - u2)) + t.e2 * (su * u2);
+    }
+};
@@ -0,0 +1,239 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include "RenderStrategy.h"
+#include "FrameBuffer.h"
+#include "PerfStats.h"
+#include "Parallel.h"
+
+struct BenchmarkSettings {
+    std::vector<std::pair<unsigned, unsigned>> resolutions{ { 128, 96 }, { 256, 192 } };
+    std::vector<unsigned> threads;      // empty: 1 and every hardware thread
+    unsigned warmup = 1;
+    unsigned repetitions = 7;
+    std::string objPath = "../models/benchmark.obj";
+    std::vector<size_t> stressSizes;    // primitive counts of extra "stress-N" scenes, for scaling charts
+    std::string output = "benchmark.json";
+    std::string baseline;               // a file written by an earlier run, empty to skip the comparison
+    double tolerance = 0.05;            // a median this much slower than the baseline's is a regression
+};
+
+struct BenchmarkResult {
+    std::string scene;
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned threads = 0;
+    std::uint64_t triangles = 0;    // of all meshes, so results of different models are told apart
+    double medianMs = 0.0;
+    double p10Ms = 0.0;
+    double p90Ms = 0.0;
+    double minMs = 0.0;
+    double maxMs = 0.0;
+    std::uint64_t raysPerFrame = 0;
+    double raysPerSecond = 0.0;     // at the median time
+    double sceneBuildMs = 0.0;      // prepareScene() of the last frame
+    size_t memoryBytes = 0;         // scene meshes and tracer data
+};
+
+// Renders each scene it is given at every resolution and thread count of the settings with
+// default tracer settings, so runs on different builds or machines measure the same work.
+// Results are written as JSON with one case per line, which is also what the baseline reader
+// expects.
+class Benchmark {
+public:
+    explicit Benchmark(const BenchmarkSettings& settings) : s(settings) {
+        if (s.threads.empty()) {
+            s.threads.push_back(1);
+            const unsigned all = Parallel::defaultThreadCount();
+            if (all > 1) s.threads.push_back(all);
+        }
+    }
+
+    void run(const std::string& sceneName, Scene& scene) {
+        for (const auto& resolution : s.resolutions) {
+            for (unsigned threads : s.threads) {
+                results.push_back(measure(sceneName, scene, resolution.first, resolution.second, threads));
+                print(results.back());
+            }
+        }
+    }
+
+    // Writes the results and compares them with the baseline; the exit code for main(). A
+    // baseline that was asked for but cannot be read fails the run.
+    int finish() const {
+        writeJson();
+        if (s.baseline.empty()) return 0;
+
+        std::vector<BenchmarkResult> baseline;
+        if (!readResults(s.baseline, baseline)) return 1;
+        return compare(baseline) ? 0 : 1;
+    }
+
+private:
+    BenchmarkSettings s;
+    std::vector<BenchmarkResult> results;
+
+    BenchmarkResult measure(const std::string& sceneName, Scene& scene, unsigned width, unsigned height, unsigned threads) {
+        using Clock = std::chrono::steady_clock;
+
+        BenchmarkResult r;
+        r.scene = sceneName;
+        r.width = width;
+        r.height = height;
+        r.threads = threads;
+
+        size_t meshBytes = 0;
+        for (auto* mesh : scene.getAllMeshes()) {
+            meshBytes += sizeof(Mesh) + mesh->memoryBytes();
+            for (const auto& face : mesh->geometry()) r.triangles += face.vertices.size() >= 3 ? face.vertices.size() - 2 : 0;
+        }
+
+        RayTracingStrategy tracer;
+        FrameBuffer frame;
+        frame.resize(width, height);
+        Parallel::setThreadLimit(threads);
+
+        for (unsigned i = 0; i < s.warmup; ++i) tracer.render(frame, scene);
+
+        std::vector<double> times;
+        for (unsigned i = 0; i < std::max(1u, s.repetitions); ++i) {
+            const RayCounters::Totals before = RayCounters::read();
+            const auto start = Clock::now();
+            tracer.render(frame, scene);
+            times.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+            r.raysPerFrame = (RayCounters::read() - before).totalRays();
+        }
+        Parallel::setThreadLimit(0);
+        r.sceneBuildMs = tracer.getSceneBuildMs();
+        r.memoryBytes = meshBytes + tracer.memoryBytes();
+
+        std::sort(times.begin(), times.end());
+        r.medianMs = percentile(times, 0.5);
+        r.p10Ms = percentile(times, 0.1);
+        r.p90Ms = percentile(times, 0.9);
+        r.minMs = times.front();
+        r.maxMs = times.back();
+        r.raysPerSecond = r.medianMs > 0.0 ? double(r.raysPerFrame) / (r.medianMs / 1000.0) : 0.0;
+        return r;
+    }
+
+    // linear interpolation between the two closest ranks of sorted values
+    static double percentile(const std::vector<double>& sorted, double p) {
+        const double rank = p * double(sorted.size() - 1);
+        const size_t lo = static_cast<size_t>(rank);
+        const size_t hi = std::min(lo + 1, sorted.size() - 1);
+        return sorted[lo] + (sorted[hi] - sorted[lo]) * (rank - double(lo));
+    }
+
+    static void print(const BenchmarkResult& r) {
+        std::cout << "Benchmark " << r.scene << " " << r.width << "x" << r.height << ", " << r.threads
+            << (r.threads == 1 ? " thread" : " threads") << ": median " << r.medianMs << " ms (p10 " << r.p10Ms
+            << ", p90 " << r.p90Ms << "), " << r.raysPerSecond * 1e-6 << " Mrays/s" << std::endl;
+    }
+
+    void writeJson() const {
+        std::ofstream out(s.output);
+        if (!out) {
+            std::cerr << "Cannot write benchmark results: " << s.output << std::endl;
+            return;
+        }
+
+        out << "{\n\"version\": 1,\n\"warmup\": " << s.warmup << ",\n\"repetitions\": " << s.repetitions
+            << ",\n\"hardwareThreads\": " << Parallel::defaultThreadCount() << ",\n\"results\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchmarkResult& r = results[i];
+            char line[640];
+            std::snprintf(line, sizeof(line),
+                "{\"scene\": \"%s\", \"width\": %u, \"height\": %u, \"threads\": %u, \"triangles\": %llu, \"medianMs\": %.4f, "
+                "\"p10Ms\": %.4f, \"p90Ms\": %.4f, \"minMs\": %.4f, \"maxMs\": %.4f, \"raysPerFrame\": %llu, "
+                "\"raysPerSecond\": %.1f, \"sceneBuildMs\": %.4f, \"memoryBytes\": %llu}",
+                r.scene.c_str(), r.width, r.height, r.threads, static_cast<unsigned long long>(r.triangles), r.medianMs, r.p10Ms, r.p90Ms, r.minMs, r.maxMs,
+                static_cast<unsigned long long>(r.raysPerFrame), r.raysPerSecond, r.sceneBuildMs,
+                static_cast<unsigned long long>(r.memoryBytes));
+            out << line << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "]\n}\n";
+        std::cout << "Benchmark results written to " << s.output << std::endl;
+    }
+
+    // Only the result lines of a file written by writeJson() are read; false when there are none
+    static bool readResults(const std::string& path, std::vector<BenchmarkResult>& loaded) {
+        std::ifstream in(path);
+        if (!in) {
+            std::cerr << "Cannot read benchmark baseline: " << path << std::endl;
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.find("\"scene\"") == std::string::npos) continue;
+
+            BenchmarkResult r;
+            r.scene = stringField(line, "scene");
+            r.width = static_cast<unsigned>(numberField(line, "width"));
+            r.height = static_cast<unsigned>(numberField(line, "height"));
+            r.threads = static_cast<unsigned>(numberField(line, "threads"));
+            r.triangles = static_cast<std::uint64_t>(numberField(line, "triangles"));
+            r.medianMs = numberField(line, "medianMs");
+            r.raysPerSecond = numberField(line, "raysPerSecond");
+            loaded.push_back(r);
+        }
+
+        if (loaded.empty()) {
+            std::cerr << "No benchmark results in baseline: " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    static std::string stringField(const std::string& line, const std::string& key) {
+        const size_t at = line.find("\"" + key + "\": \"");
+        if (at == std::string::npos) return {};
+        const size_t begin = at + key.size() + 5;
+        return line.substr(begin, line.find('"', begin) - begin);
+    }
+
+    static double numberField(const std::string& line, const std::string& key) {
+        const size_t at = line.find("\"" + key + "\": ");
+        if (at == std::string::npos) return 0.0;
+        return std::atof(line.c_str() + at + key.size() + 4);
+    }
+
+    bool compare(const std::vector<BenchmarkResult>& baseline) const {
+        bool ok = true;
+        std::cout << "Compared with " << s.baseline << ":" << std::endl;
+
+        for (const BenchmarkResult& r : results) {
+            auto it = std::find_if(baseline.begin(), baseline.end(), [&](const BenchmarkResult& b) {
+                return b.scene == r.scene && b.width == r.width && b.height == r.height && b.threads == r.threads;
+                });
+            if (it == baseline.end() || it->medianMs <= 0.0) {
+                std::cout << "  " << r.scene << " " << r.width << "x" << r.height << " x" << r.threads << ": not in baseline" << std::endl;
+                continue;
+            }
+            if (it->triangles != 0 && it->triangles != r.triangles) {
+                std::cout << "  " << r.scene << " " << r.width << "x" << r.height << " x" << r.threads << ": "
+                    << it->triangles << " triangles in baseline, " << r.triangles << " now, not compared" << std::endl;
+                continue;
+            }
+
+            const double ratio = r.medianMs / it->medianMs;
+            const bool slower = ratio > 1.0 + s.tolerance;
+            const bool faster = ratio < 1.0 - s.tolerance;
+            ok = ok && !slower;
+
+            char change[32];
+            std::snprintf(change, sizeof(change), "%+.1f%%", (ratio - 1.0) * 100.0);
+            std::cout << "  " << r.scene << " " << r.width << "x" << r.height << " x" << r.threads << ": "
+                << it->medianMs << " -> " << r.medianMs << " ms (" << change << ")"
+                << (slower ? " REGRESSION" : faster ? " faster" : "") << std::endl;
+        }
+        return ok;
+    }
+};
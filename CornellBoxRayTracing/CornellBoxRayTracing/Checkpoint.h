@@ -0,0 +1,127 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <system_error>
+
+// Progressive accumulation saved to disk: per-pixel radiance sums, the number of samples
+// behind them and the key of the scene/camera/settings they belong to. The sampler is a
+// pure function of (pixel, sample index), so the sample count is all the RNG state there is.
+//
+// Layout: Header, width * height * 3 floats, FNV-1a checksum of everything before it.
+struct AccumulationCheckpoint {
+    struct Header {
+        char magic[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '\0', '\0' };
+        std::uint32_t version = VERSION;
+        std::uint32_t width = 0;
+        std::uint32_t height = 0;
+        std::uint32_t samples = 0;
+        std::uint64_t sceneKey = 0;
+    };
+
+    static constexpr std::uint32_t VERSION = 1;
+
+    // Written to path + ".tmp" and renamed over path, so a crash mid-write leaves the
+    // previous checkpoint intact
+    static bool write(const std::string& path, const Header& header, const std::vector<glm::vec3>& sums) {
+        if (sums.size() != size_t(header.width) * header.height) return false;
+
+        const std::string tmpPath = path + ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                std::cerr << "Cannot open file: " << tmpPath << std::endl;
+                return false;
+            }
+
+            std::uint64_t checksum = CHECKSUM_SEED;
+            auto put = [&](const void* data, size_t size) {
+                out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+                checksum = fnv(checksum, data, size);
+                };
+
+            put(&header, sizeof(header));
+            put(sums.data(), sums.size() * sizeof(glm::vec3));
+            out.write(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+
+            out.flush();
+            if (!out) {
+                std::cerr << "Write failed: " << tmpPath << std::endl;
+                return false;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, path, ec);
+        if (ec) {
+            std::cerr << "Cannot replace checkpoint " << path << ": " << ec.message() << std::endl;
+            std::filesystem::remove(tmpPath, ec);
+            return false;
+        }
+        return true;
+    }
+
+    // false when the file is missing, truncated, corrupt or from another format version. The
+    // file size has to match the header's resolution before anything is allocated for it.
+    static bool read(const std::string& path, Header& header, std::vector<glm::vec3>& sums) {
+        std::error_code ec;
+        const std::uintmax_t fileSize = std::filesystem::file_size(path, ec);
+        if (ec || fileSize < sizeof(Header) + sizeof(std::uint64_t)) return false;
+
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return false;
+
+        Header h;
+        if (!in.read(reinterpret_cast<char*>(&h), sizeof(h))) return false;
+        if (std::memcmp(h.magic, Header{}.magic, sizeof(h.magic)) != 0 || h.version != VERSION) return false;
+
+        // compared as a count, so a huge width * height cannot overflow the expected size
+        const std::uintmax_t payload = fileSize - sizeof(Header) - sizeof(std::uint64_t);
+        const std::uint64_t count = std::uint64_t(h.width) * h.height;
+        if (payload % sizeof(glm::vec3) != 0 || payload / sizeof(glm::vec3) != count) return false;
+
+        std::vector<glm::vec3> data(static_cast<size_t>(count));
+        if (!in.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(count * sizeof(glm::vec3)))) return false;
+
+        std::uint64_t stored = 0;
+        if (!in.read(reinterpret_cast<char*>(&stored), sizeof(stored))) return false;
+
+        std::uint64_t checksum = fnv(CHECKSUM_SEED, &h, sizeof(h));
+        checksum = fnv(checksum, data.data(), count * sizeof(glm::vec3));
+        if (checksum != stored) return false;
+
+        header = h;
+        sums = std::move(data);
+        return true;
+    }
+
+private:
+    static constexpr std::uint64_t CHECKSUM_SEED = 1469598103934665603ull;
+
+    static std::uint64_t fnv(std::uint64_t h, const void* data, size_t size) {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            h ^= bytes[i];
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+};
+
+struct CheckpointStats {
+    unsigned writes = 0;
+    double writeSeconds = 0.0;
+    double lastWriteSeconds = 0.0;
+    double renderSeconds = 0.0;
+    unsigned resumedSamples = 0;
+
+    // share of the render's wall time spent writing checkpoints
+    double overhead() const {
+        return renderSeconds > 0.0 ? writeSeconds / renderSeconds : 0.0;
+    }
+};
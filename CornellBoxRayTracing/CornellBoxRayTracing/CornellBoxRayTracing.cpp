@@ -1,6 +1,120 @@
 #include "Application.h"
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+
+int main(int argc, char** argv) {
+	DistributedRenderer::setExecutable(argv[0]);
+
+	// --render-worker <scene> <fd> <threads>, started by a distributed render
+	if (argc == 5 && std::string(argv[1]) == "--render-worker") {
+		return DistributedRenderer::runWorkerProcess(argv[2], std::atoi(argv[3]), static_cast<unsigned>(std::max(1, std::atoi(argv[4]))));
+	}
+
+	// --render <file.ppm|file.pfm> [--scene file] [--size WxH] [--band n] [--aa n] [--path-tracing]
+	//          [--samples n] [--workers n] [--worker-threads n] [--tile n] [--views file]
+	// With --views, every camera in the file is rendered to <file>_<i>.ppm|pfm in this process
+	if (argc >= 3 && std::string(argv[1]) == "--render") {
+		OfflineRenderSettings settings;
+		RayTracingSettings tracerSettings;
+		std::string scenePath;
+		std::string viewsPath;
+		settings.path = argv[2];
+		if (settings.path.size() >= 4 && settings.path.compare(settings.path.size() - 4, 4, ".pfm") == 0) settings.format = OfflineFormat::PFM;
+
+		for (int i = 3; i < argc; ++i) {
+			const std::string arg = argv[i];
+			const bool hasValue = i + 1 < argc;
+			if (arg == "--scene" && hasValue) scenePath = argv[++i];
+			else if (arg == "--views" && hasValue) viewsPath = argv[++i];
+			else if (arg == "--size" && hasValue && std::sscanf(argv[i + 1], "%ux%u", &settings.width, &settings.height) == 2) ++i;
+			else if (arg == "--band" && hasValue) settings.bandHeight = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+			else if (arg == "--aa" && hasValue) tracerSettings.antialiasingSamples = std::max(1, std::atoi(argv[++i]));
+			else if (arg == "--path-tracing") tracerSettings.integrator = Integrator::PathTracing;
+			else if (arg == "--samples" && hasValue) tracerSettings.targetSamples = std::max(1, std::atoi(argv[++i]));
+			else if (arg == "--workers" && hasValue) settings.distributed.workers = static_cast<unsigned>(std::max(0, std::atoi(argv[++i])));
+			else if (arg == "--worker-threads" && hasValue) settings.distributed.threadsPerWorker = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+			else if (arg == "--tile" && hasValue) settings.distributed.tileHeight = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+			else {
+				std::cerr << "Unknown render option: " << arg << std::endl;
+				return 2;
+			}
+		}
+
+		if (!viewsPath.empty() && settings.distributed.workers > 0) {
+			std::cerr << "--views renders in this process and cannot be combined with --workers" << std::endl;
+			return 2;
+		}
+
+		Application app(true);
+		return app.runOfflineRender(settings, tracerSettings, scenePath, viewsPath);
+	}
+
+	// --server <socket> [--counters]
+	if ((argc == 3 || argc == 4) && std::string(argv[1]) == "--server") {
+		const bool counters = argc == 4 && std::string(argv[3]) == "--counters";
+		Application app(true);
+		return app.runServer(argv[2], counters);
+	}
+
+	// --benchmark [--out file.json] [--baseline file.json] [--reps n] [--warmup n] [--obj file.obj]
+	//             [--stress n,n,...] [--quick]
+	if (argc >= 2 && std::string(argv[1]) == "--benchmark") {
+		BenchmarkSettings settings;
+		for (int i = 2; i < argc; ++i) {
+			const std::string arg = argv[i];
+			const bool hasValue = i + 1 < argc;
+			if (arg == "--out" && hasValue) settings.output = argv[++i];
+			else if (arg == "--baseline" && hasValue) settings.baseline = argv[++i];
+			else if (arg == "--reps" && hasValue) settings.repetitions = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+			else if (arg == "--warmup" && hasValue) settings.warmup = static_cast<unsigned>(std::max(0, std::atoi(argv[++i])));
+			else if (arg == "--obj" && hasValue) settings.objPath = argv[++i];
+			else if (arg == "--stress" && hasValue) {
+				std::stringstream list(argv[++i]);
+				std::string count;
+				while (std::getline(list, count, ',')) settings.stressSizes.push_back(std::strtoull(count.c_str(), nullptr, 10));
+			}
+			else if (arg == "--quick") settings.resolutions = { { 128, 96 } };
+			else {
+				std::cerr << "Unknown benchmark option: " << arg << std::endl;
+				return 2;
+			}
+		}
+
+		Application app(true);
+		return app.runBenchmark(settings);
+	}
+
+	// --regression [--golden dir] [--update] [--timing file] [--reps n] [--time-tolerance x]
+	if (argc >= 2 && std::string(argv[1]) == "--regression") {
+		RegressionSettings settings;
+		for (int i = 2; i < argc; ++i) {
+			const std::string arg = argv[i];
+			const bool hasValue = i + 1 < argc;
+			if (arg == "--golden" && hasValue) settings.directory = argv[++i];
+			else if (arg == "--update") settings.update = true;
+			else if (arg == "--timing" && hasValue) settings.timing = argv[++i];
+			else if (arg == "--reps" && hasValue) settings.repetitions = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+			else if (arg == "--time-tolerance" && hasValue) settings.timeTolerance = std::atof(argv[++i]);
+			else {
+				std::cerr << "Unknown regression option: " << arg << std::endl;
+				return 2;
+			}
+		}
+
+		Application app(true);
+		return app.runRegression(settings);
+	}
+
+	// --microbench [kernel name filter]
+	if ((argc == 2 || argc == 3) && std::string(argv[1]) == "--microbench") {
+		Application app(true);
+		return app.runMicrobenchmarks(argc == 3 ? argv[2] : "");
+	}
 
-int main() {
 	Application app;
 	app.run();
 	return 0;
@@ -28,7 +28,7 @@ public:
     }
 
     void addToScene(Scene& scene) {
-        scene.getRoot()->children.push_back(std::move(roomNode));
+        scene.getRoot()->addChild(std::move(roomNode));
     }
 
     void setLeftWallColor(const glm::vec3& color) { setWallColor(LEFT, color); }
@@ -38,6 +38,8 @@ public:
     void setCeilingColor(const glm::vec3& color) { setWallColor(CEILING, color); }
     void setFrontWallColor(const glm::vec3& color) { setWallColor(FRONT, color); }
 
+    float getRoomSize() const { return roomSize; }
+
     void setWallColor(int wallIndex, const glm::vec3& color) {
         if (wallIndex >= 0 && wallIndex < (int)walls.size() && wallNodes[wallIndex]) {
             wallNodes[wallIndex]->mesh->material.diffuseColor = color;
@@ -135,7 +137,7 @@ private:
         else if (name == "FrontWall") frontWall = wallNode.get();
 
         wallNodes[wallIndex] = wallNode.get();
-        roomNode->children.push_back(std::move(wallNode));
+        roomNode->addChild(std::move(wallNode));
     }
 
     std::unique_ptr<Mesh> createWallMesh(const std::string& wallName) {
@@ -0,0 +1,88 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+#include "FrameBuffer.h"
+
+enum class CostMetric {
+    Rays,               // camera, secondary and shadow rays
+    TriangleTests,
+    SphereTests,
+    TraversalSteps,     // objects visited by rays
+    Depth               // deepest bounce reached
+};
+
+// Work done for one pixel, summed over its samples
+struct PixelCost {
+    std::uint32_t rays = 0;
+    std::uint32_t triangleTests = 0;
+    std::uint32_t sphereTests = 0;
+    std::uint32_t traversalSteps = 0;
+    std::uint32_t depth = 0;
+
+    std::uint32_t get(CostMetric metric) const {
+        switch (metric) {
+        case CostMetric::Rays: return rays;
+        case CostMetric::TriangleTests: return triangleTests;
+        case CostMetric::SphereTests: return sphereTests;
+        case CostMetric::TraversalSteps: return traversalSteps;
+        case CostMetric::Depth: return depth;
+        }
+        return 0;
+    }
+};
+
+class CostHeatmap {
+public:
+    // Paints one metric over the frame, from black at zero to white at the frame's maximum
+    static void paint(const std::vector<PixelCost>& costs, CostMetric metric, FrameBuffer& frame) {
+        if (costs.size() != size_t(frame.width) * frame.height) return;
+
+        std::uint32_t peak = 1;
+        for (const auto& c : costs) peak = std::max(peak, c.get(metric));
+
+        for (unsigned y = 0; y < frame.height; ++y) {
+            std::uint8_t* row = frame.row(y);
+            for (unsigned x = 0; x < frame.width; ++x) {
+                glm::vec3 c = falseColor(float(costs[size_t(y) * frame.width + x].get(metric)) / float(peak));
+                row[4 * x + 0] = static_cast<std::uint8_t>(c.r * 255.0f + 0.5f);
+                row[4 * x + 1] = static_cast<std::uint8_t>(c.g * 255.0f + 0.5f);
+                row[4 * x + 2] = static_cast<std::uint8_t>(c.b * 255.0f + 0.5f);
+                row[4 * x + 3] = 255;
+            }
+        }
+    }
+
+    static void printSummary(const std::vector<PixelCost>& costs) {
+        if (costs.empty()) return;
+
+        const char* names[] = { "rays", "triangle tests", "sphere tests", "traversal steps", "depth" };
+        std::cout << "Pixel cost:";
+        for (int m = 0; m < 5; ++m) {
+            std::uint64_t total = 0;
+            std::uint32_t peak = 0;
+            for (const auto& c : costs) {
+                total += c.get(static_cast<CostMetric>(m));
+                peak = std::max(peak, c.get(static_cast<CostMetric>(m)));
+            }
+            std::cout << (m ? "," : "") << " " << names[m] << " mean " << double(total) / double(costs.size())
+                << " max " << peak;
+        }
+        std::cout << std::endl;
+    }
+
+    // black, blue, cyan, green, yellow, red, white at t = 0, 1/6 ... 1
+    static glm::vec3 falseColor(float t) {
+        static const glm::vec3 ramp[] = {
+            { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 1.0f }, { 0.0f, 1.0f, 0.0f },
+            { 1.0f, 1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f }
+        };
+        constexpr int last = 6;
+
+        t = std::clamp(t, 0.0f, 1.0f) * float(last);
+        const int i = std::min(last - 1, static_cast<int>(t));
+        return glm::mix(ramp[i], ramp[i + 1], t - float(i));
+    }
+};
@@ -0,0 +1,566 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <deque>
+#include <set>
+#include <map>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include "RenderStrategy.h"
+#include "SceneFile.h"
+#include "Parallel.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#include <cstdlib>
+#define DISTRIBUTED_RENDERING_SUPPORTED 1
+#else
+#define DISTRIBUTED_RENDERING_SUPPORTED 0
+#endif
+
+struct DistributedRenderSettings {
+    unsigned workers = 0;           // 0 renders in this process
+    unsigned threadsPerWorker = 1;
+    unsigned tileHeight = 16;
+    unsigned tilesInFlight = 2;     // per worker, so a worker never waits for its next tile
+    unsigned reorderTiles = 0;      // finished tiles held back for in-order output; 0: twice those in flight
+    float tileTimeout = 120.0f;     // seconds without a finished tile before a worker counts as lost
+};
+
+struct DistributedRenderStats {
+    unsigned workersStarted = 0;
+    unsigned workersLost = 0;
+    unsigned tilesIssued = 0;
+    unsigned tilesReissued = 0;
+    unsigned tilesLocal = 0;
+    size_t maxTilesHeld = 0;
+    double seconds = 0.0;
+};
+
+// Coordinator/worker rendering on one machine. The coordinator writes the scene to a temporary
+// scene file once and starts every worker by running this program again in worker mode
+// (--render-worker), so a worker loads the scene itself and inherits no threads or locks of
+// the coordinator. Tiles are bands of rows handed out on demand over a socket pair per worker;
+// the tiles of a worker that exits or stops answering are re-issued to the others, and
+// whatever is left when every worker is gone is rendered locally. Finished tiles are passed on
+// in output order; tiles are never issued further than reorderTiles ahead of the next one due,
+// so the tiles held back never take more memory than that many bands.
+class DistributedRenderer {
+public:
+    static bool supported() { return DISTRIBUTED_RENDERING_SUPPORTED != 0; }
+
+    // The program started for workers; main() passes argv[0]. It is resolved to an absolute
+    // path right away, since execv() does not search PATH. Linux starts /proc/self/exe instead.
+    static void setExecutable(const std::string& argv0) { executable() = resolveProgram(argv0); }
+
+    // Renders the width x height frame in bands. onTile(y0, y1, colors) receives the linear
+    // colours of rows [y0, y1) in output order, top to bottom or, with bottomUp, bottom to top;
+    // progress(rowsDone, totalRows) follows every tile.
+    template <typename TileFn, typename ProgressFn>
+    static bool render(RayTracingStrategy& tracer, const Scene& scene, unsigned width, unsigned height, bool bottomUp,
+        const DistributedRenderSettings& s, TileFn&& onTile, ProgressFn&& progress, DistributedRenderStats* stats = nullptr)
+    {
+        if (!tracer.beginFrame(scene, width, height)) return false;
+
+        DistributedRenderStats local;
+        DistributedRenderStats& st = stats ? *stats : local;
+        st = DistributedRenderStats{};
+        const auto start = std::chrono::steady_clock::now();
+
+        // tiles are numbered in output order
+        const unsigned tileHeight = std::max(1u, s.tileHeight);
+        const unsigned tileCount = (height + tileHeight - 1) / tileHeight;
+        auto tileRows = [=](unsigned tile, unsigned& y0, unsigned& y1) {
+            const unsigned band = bottomUp ? tileCount - 1 - tile : tile;
+            y0 = band * tileHeight;
+            y1 = std::min(height, y0 + tileHeight);
+            };
+
+        std::set<unsigned> pending;
+        for (unsigned t = 0; t < tileCount; ++t) pending.insert(t);
+
+        std::map<unsigned, std::vector<glm::vec3>> held;
+        unsigned nextTile = 0;
+        unsigned rowsDone = 0;
+        auto storeTile = [&](unsigned tile, std::vector<glm::vec3>& colors) {
+            held[tile].swap(colors);
+            st.maxTilesHeld = std::max(st.maxTilesHeld, held.size());
+
+            for (auto it = held.begin(); it != held.end() && it->first == nextTile; it = held.erase(it), ++nextTile) {
+                unsigned y0, y1;
+                tileRows(it->first, y0, y1);
+                onTile(y0, y1, it->second.data());
+                rowsDone += y1 - y0;
+                progress(rowsDone, height);
+            }
+            };
+
+#if DISTRIBUTED_RENDERING_SUPPORTED
+        if (s.workers > 0) {
+            const unsigned window = s.reorderTiles > 0 ? s.reorderTiles : 2 * s.workers * std::max(1u, s.tilesInFlight);
+            auto issuable = [&](unsigned tile) { return tile < nextTile + window; };
+            runCoordinator(tracer, scene, width, height, s, tileRows, issuable, pending, storeTile, st);
+        }
+#else
+        if (s.workers > 0) {
+            std::cerr << "Worker processes need a POSIX system, rendering in this process" << std::endl;
+        }
+#endif
+
+        // no workers, or all of them lost
+        std::vector<glm::vec3> colors;
+        while (!pending.empty()) {
+            const unsigned tile = *pending.begin();
+            pending.erase(pending.begin());
+            unsigned y0, y1;
+            tileRows(tile, y0, y1);
+            tracer.renderRows(scene, y0, y1, colors);
+            storeTile(tile, colors);
+            ++st.tilesLocal;
+        }
+
+        st.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Distributed render: " << st.workersStarted << " workers (" << st.workersLost << " lost), "
+            << st.tilesIssued << " tiles issued, " << st.tilesReissued << " re-issued, " << st.tilesLocal
+            << " rendered locally, " << st.maxTilesHeld << " held at most, " << st.seconds << " s" << std::endl;
+        return true;
+    }
+
+    // Body of a worker process: loads the scene the coordinator wrote, then renders the tiles
+    // it is sent until the socket closes. Returns the exit code.
+    static int runWorkerProcess(const std::string& scenePath, int fd, unsigned threads) {
+#if DISTRIBUTED_RENDERING_SUPPORTED
+        WorkerSetup setup;
+        if (!recvAll(fd, &setup, sizeof(setup))) return 1;
+
+        Scene scene;
+        if (!SceneFile::load(scenePath, scene)) return 1;
+
+        Parallel::setThreadLimit(std::max(1u, threads));
+        RayTracingStrategy tracer;
+        tracer.settings = fromSetup(setup);
+        if (!tracer.beginFrame(scene, setup.width, setup.height)) return 1;
+
+        runWorker(tracer, scene, fd);
+        return 0;
+#else
+        (void)scenePath;
+        (void)fd;
+        (void)threads;
+        std::cerr << "Worker processes need a POSIX system" << std::endl;
+        return 1;
+#endif
+    }
+
+private:
+    static std::string& executable() {
+        static std::string path;
+        return path;
+    }
+
+    // a path with a slash is taken relative to the working directory, a bare name is looked up
+    // in PATH the way the shell did; empty when it cannot be found
+    static std::string resolveProgram(const std::string& argv0) {
+        std::error_code ec;
+        if (argv0.find('/') != std::string::npos) {
+            const auto path = std::filesystem::absolute(argv0, ec);
+            return ec ? std::string() : path.string();
+        }
+#if DISTRIBUTED_RENDERING_SUPPORTED
+        const char* searchPath = std::getenv("PATH");
+        std::string dirs = searchPath ? searchPath : "";
+        for (size_t begin = 0; begin <= dirs.size();) {
+            size_t end = dirs.find(':', begin);
+            if (end == std::string::npos) end = dirs.size();
+            const std::string dir = end > begin ? dirs.substr(begin, end - begin) : ".";
+            const std::string candidate = dir + "/" + argv0;
+            if (!argv0.empty() && access(candidate.c_str(), X_OK) == 0) {
+                const auto path = std::filesystem::absolute(candidate, ec);
+                if (!ec) return path.string();
+            }
+            begin = end + 1;
+        }
+#endif
+        return std::string();
+    }
+
+    // the tracer settings a worker needs for renderRows(), sent ahead of the first tile
+    struct WorkerSetup {
+        std::uint32_t width = 0;
+        std::uint32_t height = 0;
+        Integrator integrator = Integrator::Whitted;
+        SamplerType sampler = SamplerType::OwenSobolBlueNoise;
+        std::int32_t antialiasingSamples = 1;
+        std::int32_t maxDepth = 6;
+        std::int32_t wavefront = 0;
+        std::int32_t wavefrontTileSize = 128;
+        std::int32_t targetSamples = 1;
+        std::int32_t pathMaxDepth = 8;
+        std::int32_t rouletteDepth = 3;
+        ShadowMode shadowMode = ShadowMode::ExactRays;
+        std::int32_t shadowMapResolution = 512;
+        std::int32_t shadowMapFilterRadius = 1;
+        std::int32_t useLightTree = 1;
+        std::int32_t maxLightsPerHit = 16;
+        float lightCutoffRadius = 0.0f;
+        std::int32_t areaLights = 1;
+        std::int32_t areaLightSamples = 16;
+        std::int32_t areaLightProbes = 4;
+        std::int32_t maxAreaLightsPerHit = 4;
+    };
+
+    static WorkerSetup toSetup(const RayTracingSettings& t, unsigned width, unsigned height) {
+        WorkerSetup w;
+        w.width = width;
+        w.height = height;
+        w.integrator = t.integrator;
+        w.sampler = t.sampler;
+        w.antialiasingSamples = t.antialiasingSamples;
+        w.maxDepth = t.maxDepth;
+        w.wavefront = t.wavefront;
+        w.wavefrontTileSize = t.wavefrontTileSize;
+        w.targetSamples = t.targetSamples;
+        w.pathMaxDepth = t.pathMaxDepth;
+        w.rouletteDepth = t.rouletteDepth;
+        w.shadowMode = t.shadowMode;
+        w.shadowMapResolution = t.shadowMapResolution;
+        w.shadowMapFilterRadius = t.shadowMapFilterRadius;
+        w.useLightTree = t.useLightTree;
+        w.maxLightsPerHit = t.maxLightsPerHit;
+        w.lightCutoffRadius = t.lightCutoffRadius;
+        w.areaLights = t.areaLights;
+        w.areaLightSamples = t.areaLightSamples;
+        w.areaLightProbes = t.areaLightProbes;
+        w.maxAreaLightsPerHit = t.maxAreaLightsPerHit;
+        return w;
+    }
+
+    static RayTracingSettings fromSetup(const WorkerSetup& w) {
+        RayTracingSettings t;
+        t.integrator = w.integrator;
+        t.sampler = w.sampler;
+        t.antialiasingSamples = w.antialiasingSamples;
+        t.maxDepth = w.maxDepth;
+        t.wavefront = w.wavefront != 0;
+        t.wavefrontTileSize = w.wavefrontTileSize;
+        t.targetSamples = w.targetSamples;
+        t.pathMaxDepth = w.pathMaxDepth;
+        t.rouletteDepth = w.rouletteDepth;
+        t.shadowMode = w.shadowMode;
+        t.shadowMapResolution = w.shadowMapResolution;
+        t.shadowMapFilterRadius = w.shadowMapFilterRadius;
+        t.useLightTree = w.useLightTree != 0;
+        t.maxLightsPerHit = w.maxLightsPerHit;
+        t.lightCutoffRadius = w.lightCutoffRadius;
+        t.areaLights = w.areaLights != 0;
+        t.areaLightSamples = w.areaLightSamples;
+        t.areaLightProbes = w.areaLightProbes;
+        t.maxAreaLightsPerHit = w.maxAreaLightsPerHit;
+        return t;
+    }
+
+#if DISTRIBUTED_RENDERING_SUPPORTED
+    struct TileRequest {
+        std::uint32_t tile = 0;
+        std::uint32_t y0 = 0;
+        std::uint32_t y1 = 0;
+    };
+
+    struct TileReply {
+        std::uint32_t tile = 0;
+        std::uint32_t rows = 0;
+    };
+
+    struct Worker {
+        pid_t pid = -1;
+        int fd = -1;
+        std::deque<unsigned> inFlight;
+        std::vector<char> received;
+        std::chrono::steady_clock::time_point lastReply;
+        bool setupSent = false;
+    };
+
+    template <typename TileRowsFn, typename IssuableFn, typename StoreFn>
+    static void runCoordinator(const RayTracingStrategy& tracer, const Scene& scene, unsigned width, unsigned height,
+        const DistributedRenderSettings& s, TileRowsFn& tileRows, IssuableFn& issuable, std::set<unsigned>& pending,
+        StoreFn& storeTile, DistributedRenderStats& st)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        std::error_code ec;
+        const std::string scenePath = (std::filesystem::temp_directory_path(ec) /
+            ("distributed-" + std::to_string(getpid()) + ".rtscene")).string();
+        if (!SceneFile::save(scene, scenePath)) {
+            std::cerr << "Cannot write the scene for the workers, rendering in this process" << std::endl;
+            return;
+        }
+
+#ifdef __linux__
+        const std::string program = access("/proc/self/exe", X_OK) == 0 ? std::string("/proc/self/exe") : executable();
+#else
+        const std::string program = executable();
+#endif
+        const std::string threads = std::to_string(std::max(1u, s.threadsPerWorker));
+        const WorkerSetup setup = toSetup(tracer.settings, width, height);
+
+        // everything the child needs is prepared here; between fork and exec it may only make
+        // async-signal-safe calls, since other threads of this process can hold locks
+        const std::string fd = std::to_string(WORKER_SOCKET);
+        const char* argv[] = { program.c_str(), "--render-worker", scenePath.c_str(), fd.c_str(), threads.c_str(), nullptr };
+        const long openMax = sysconf(_SC_OPEN_MAX);
+        const int maxFd = openMax > 0 ? static_cast<int>(std::min<long>(openMax, 1 << 20)) : 1024;
+
+        std::vector<Worker> workers;
+        for (unsigned i = 0; i < s.workers && !program.empty(); ++i) {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) break;
+            fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+            // closed by a successful exec; otherwise the child writes its errno into it
+            int status[2];
+            if (pipe(status) != 0) {
+                close(fds[0]);
+                close(fds[1]);
+                break;
+            }
+            fcntl(status[0], F_SETFD, FD_CLOEXEC);
+            fcntl(status[1], F_SETFD, FD_CLOEXEC);
+
+            pid_t pid = fork();
+            if (pid < 0) {
+                close(fds[0]);
+                close(fds[1]);
+                close(status[0]);
+                close(status[1]);
+                break;
+            }
+            if (pid == 0) {
+                // the worker keeps stdio, its socket and the status pipe, and nothing else of
+                // this process, such as the output file or other workers' sockets
+                const int socketCopy = fcntl(fds[1], F_DUPFD, WORKER_SOCKET + 2);
+                const int statusCopy = fcntl(status[1], F_DUPFD, WORKER_SOCKET + 2);
+                dup2(socketCopy, WORKER_SOCKET);
+                dup2(statusCopy, WORKER_SOCKET + 1);
+                fcntl(WORKER_SOCKET + 1, F_SETFD, FD_CLOEXEC);
+                closeFrom(WORKER_SOCKET + 2, maxFd);
+
+                execv(program.c_str(), const_cast<char* const*>(argv));
+                const int error = errno;
+                if (write(WORKER_SOCKET + 1, &error, sizeof(error)) < 0) _exit(127);
+                _exit(127);
+            }
+
+            close(fds[1]);
+            close(status[1]);
+            int execError = 0;
+            ssize_t n;
+            while ((n = read(status[0], &execError, sizeof(execError))) < 0 && errno == EINTR) {}
+            close(status[0]);
+            if (n > 0) {
+                std::cerr << "Cannot start worker " << program << ": " << std::strerror(execError) << std::endl;
+                close(fds[0]);
+                waitpid(pid, nullptr, 0);
+                break;
+            }
+
+            Worker w;
+            w.pid = pid;
+            w.fd = fds[0];
+            workers.push_back(std::move(w));
+        }
+        st.workersStarted = static_cast<unsigned>(workers.size());
+        if (workers.empty()) {
+            std::cerr << "No worker process started" << (program.empty() ? " (program not found)" : "")
+                << ", rendering in this process" << std::endl;
+            std::filesystem::remove(scenePath, ec);
+            return;
+        }
+
+        const size_t rowBytes = size_t(width) * sizeof(glm::vec3);
+        const unsigned inFlightLimit = std::max(1u, s.tilesInFlight);
+        const auto timeout = std::chrono::duration<double>(std::max(0.1f, s.tileTimeout));
+        std::vector<glm::vec3> colors;
+
+        auto lose = [&](Worker& w) {
+            kill(w.pid, SIGKILL);
+            close(w.fd);
+            waitpid(w.pid, nullptr, 0);
+            w.fd = -1;
+            ++st.workersLost;
+
+            // lower than anything not issued yet, so they are picked up next
+            for (unsigned tile : w.inFlight) {
+                pending.insert(tile);
+                ++st.tilesReissued;
+            }
+            w.inFlight.clear();
+            };
+
+        auto issue = [&](Worker& w) {
+            if (w.fd >= 0 && !w.setupSent) {
+                if (!sendAll(w.fd, &setup, sizeof(setup))) {
+                    lose(w);
+                    return;
+                }
+                w.setupSent = true;
+            }
+            while (w.fd >= 0 && w.inFlight.size() < inFlightLimit && !pending.empty() && issuable(*pending.begin())) {
+                const unsigned tile = *pending.begin();
+                TileRequest request;
+                request.tile = tile;
+                tileRows(tile, request.y0, request.y1);
+
+                if (w.inFlight.empty()) w.lastReply = Clock::now();
+                if (!sendAll(w.fd, &request, sizeof(request))) {
+                    lose(w);
+                    return;
+                }
+                pending.erase(pending.begin());
+                w.inFlight.push_back(tile);
+                ++st.tilesIssued;
+            }
+            };
+
+        // replies come back in request order, so the oldest tile in flight is the one arriving
+        auto consume = [&](Worker& w) {
+            while (w.received.size() >= sizeof(TileReply)) {
+                TileReply reply;
+                std::memcpy(&reply, w.received.data(), sizeof(reply));
+                const size_t payload = size_t(reply.rows) * rowBytes;
+                if (w.received.size() < sizeof(reply) + payload) return true;
+
+                if (w.inFlight.empty() || w.inFlight.front() != reply.tile) return false;
+                w.inFlight.pop_front();
+
+                colors.resize(size_t(reply.rows) * width);
+                std::memcpy(colors.data(), w.received.data() + sizeof(reply), payload);
+                w.received.erase(w.received.begin(), w.received.begin() + sizeof(reply) + payload);
+                w.lastReply = Clock::now();
+
+                storeTile(reply.tile, colors);
+            }
+            return true;
+            };
+
+        std::vector<pollfd> polled;
+        std::vector<Worker*> polledWorkers;
+        char buffer[1 << 16];
+
+        for (;;) {
+            for (auto& w : workers) issue(w);
+
+            polled.clear();
+            polledWorkers.clear();
+            for (auto& w : workers) {
+                if (w.fd < 0 || w.inFlight.empty()) continue;
+                polled.push_back(pollfd{ w.fd, POLLIN, 0 });
+                polledWorkers.push_back(&w);
+            }
+            if (polled.empty()) break;
+
+            if (poll(polled.data(), static_cast<nfds_t>(polled.size()), 100) < 0 && errno != EINTR) break;
+
+            for (size_t i = 0; i < polled.size(); ++i) {
+                Worker& w = *polledWorkers[i];
+
+                if (polled[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                    ssize_t n = recv(w.fd, buffer, sizeof(buffer), 0);
+                    if (n > 0) {
+                        w.received.insert(w.received.end(), buffer, buffer + n);
+                        if (!consume(w)) lose(w);
+                    }
+                    else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+                        lose(w);
+                    }
+                }
+                else if (Clock::now() - w.lastReply > timeout) {
+                    std::cerr << "Worker " << w.pid << " timed out, re-issuing its tiles" << std::endl;
+                    lose(w);
+                }
+            }
+        }
+
+        // workers exit when their socket closes
+        for (auto& w : workers) {
+            if (w.fd < 0) continue;
+            close(w.fd);
+            waitpid(w.pid, nullptr, 0);
+        }
+        std::filesystem::remove(scenePath, ec);
+
+        if (!pending.empty() && st.workersLost == workers.size()) {
+            std::cerr << "All " << workers.size() << " workers were lost, rendering the remaining "
+                << pending.size() << " tiles in this process" << std::endl;
+        }
+    }
+
+    // descriptor numbers of the worker's socket and, until exec, the status pipe
+    static constexpr int WORKER_SOCKET = 3;
+
+    // async-signal-safe, for the child between fork and exec
+    static void closeFrom(int first, int maxFd) {
+#ifdef SYS_close_range
+        if (syscall(SYS_close_range, static_cast<unsigned>(first), ~0u, 0u) == 0) return;
+#endif
+        for (int fd = first; fd < maxFd; ++fd) close(fd);
+    }
+
+    static void runWorker(RayTracingStrategy& tracer, const Scene& scene, int fd) {
+        std::vector<glm::vec3> colors;
+        TileRequest request;
+
+        while (recvAll(fd, &request, sizeof(request))) {
+            tracer.renderRows(scene, request.y0, request.y1, colors);
+
+            TileReply reply;
+            reply.tile = request.tile;
+            reply.rows = request.y1 - request.y0;
+            if (!sendAll(fd, &reply, sizeof(reply))) break;
+            if (!sendAll(fd, colors.data(), colors.size() * sizeof(glm::vec3))) break;
+        }
+        close(fd);
+    }
+
+    static bool sendAll(int fd, const void* data, size_t size) {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t n = send(fd, p, size, flags);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static bool recvAll(int fd, void* data, size_t size) {
+        char* p = static_cast<char*>(data);
+        while (size > 0) {
+            ssize_t n = recv(fd, p, size, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+#endif
+};
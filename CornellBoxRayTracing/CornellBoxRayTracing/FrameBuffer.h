@@ -0,0 +1,140 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+// Tightly packed 8-bit RGBA pixels, the layout sf::Texture::update() takes as is
+struct FrameBuffer {
+    unsigned width = 0;
+    unsigned height = 0;
+    std::vector<std::uint8_t> pixels;
+
+    void resize(unsigned w, unsigned h) {
+        width = w;
+        height = h;
+        pixels.assign(size_t(w) * h * 4, 0);
+        for (size_t i = 3; i < pixels.size(); i += 4) pixels[i] = 255;
+    }
+
+    std::uint8_t* row(unsigned y) { return pixels.data() + size_t(y) * width * 4; }
+    const std::uint8_t* row(unsigned y) const { return pixels.data() + size_t(y) * width * 4; }
+
+    // Row y of dst, bilinearly sampled from src stretched over the whole of dst
+    static void resampleRow(const FrameBuffer& src, FrameBuffer& dst, unsigned y) {
+        const float sy = std::clamp((y + 0.5f) * src.height / float(dst.height) - 0.5f, 0.0f, float(src.height - 1));
+        const unsigned y0 = static_cast<unsigned>(sy);
+        const unsigned y1 = std::min(y0 + 1, src.height - 1);
+        const float fy = sy - float(y0);
+
+        const std::uint8_t* top = src.row(y0);
+        const std::uint8_t* bottom = src.row(y1);
+        std::uint8_t* out = dst.row(y);
+
+        for (unsigned x = 0; x < dst.width; ++x) {
+            const float sx = std::clamp((x + 0.5f) * src.width / float(dst.width) - 0.5f, 0.0f, float(src.width - 1));
+            const unsigned x0 = static_cast<unsigned>(sx);
+            const unsigned x1 = std::min(x0 + 1, src.width - 1);
+            const float fx = sx - float(x0);
+
+            for (unsigned c = 0; c < 4; ++c) {
+                float upper = top[4 * x0 + c] + (top[4 * x1 + c] - top[4 * x0 + c]) * fx;
+                float lower = bottom[4 * x0 + c] + (bottom[4 * x1 + c] - bottom[4 * x0 + c]) * fx;
+                out[4 * x + c] = static_cast<std::uint8_t>(upper + (lower - upper) * fy + 0.5f);
+            }
+        }
+    }
+};
+
+// Linear [0, 1] colour to display bytes with the tracer's 1/2.2 gamma. A table indexed
+// by the float's exponent and top mantissa bits gives the byte at the start of each
+// bucket, and one threshold compare finishes the job, so the result equals
+// round(pow(clamp(v), 1 / 2.2) * 255) exactly without calling pow per channel.
+class GammaEncoder {
+public:
+    static std::uint8_t encode(float v) {
+        return encode(v, tables());
+    }
+
+    // count pixels of linear colour to RGBA bytes with opaque alpha
+    static void encodeRow(const glm::vec3* src, size_t count, std::uint8_t* dst) {
+        const Tables& t = tables();
+        for (size_t i = 0; i < count; ++i) {
+            dst[4 * i + 0] = encode(src[i].r, t);
+            dst[4 * i + 1] = encode(src[i].g, t);
+            dst[4 * i + 2] = encode(src[i].b, t);
+            dst[4 * i + 3] = 255;
+        }
+    }
+
+    // reference conversion the tables are built from
+    static std::uint8_t encodeExact(float v) {
+        if (!(v > 0.0f)) return 0;
+        v = std::min(v, 1.0f);
+        v = std::pow(v, 1.0f / 2.2f);
+        v = std::clamp(v, 0.0f, 1.0f);
+        return static_cast<std::uint8_t>(v * 255.0f + 0.5f);
+    }
+
+private:
+    // 2^-16: everything below encodes to 0..2 and is resolved by the thresholds alone
+    static constexpr std::uint32_t MIN_BITS = 0x37800000u;
+    static constexpr std::uint32_t ONE_BITS = 0x3f800000u;
+    static constexpr int MANTISSA_SHIFT = 14;
+    static constexpr size_t BUCKETS = ((ONE_BITS - MIN_BITS) >> MANTISSA_SHIFT) + 1;
+
+    struct Tables {
+        std::vector<std::uint8_t> bucketByte;
+        // threshold[k] is the smallest float encoding to at least k; threshold[256] = +inf
+        std::array<float, 257> threshold{};
+    };
+
+    static std::uint8_t encode(float v, const Tables& t) {
+        if (!(v > 0.0f)) return 0;
+        if (v >= 1.0f) return 255;
+
+        std::uint32_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+
+        std::uint32_t b = bits >= MIN_BITS ? t.bucketByte[(bits - MIN_BITS) >> MANTISSA_SHIFT] : 0u;
+        while (v >= t.threshold[b + 1]) ++b;
+        return static_cast<std::uint8_t>(b);
+    }
+
+    static const Tables& tables() {
+        static const Tables t = buildTables();
+        return t;
+    }
+
+    static Tables buildTables() {
+        Tables t;
+
+        t.threshold[0] = 0.0f;
+        for (int k = 1; k <= 255; ++k) {
+            // smallest non-negative float whose encoding reaches k (floats order like their bits)
+            std::uint32_t lo = 0, hi = ONE_BITS;
+            while (lo < hi) {
+                std::uint32_t mid = lo + (hi - lo) / 2;
+                float f;
+                std::memcpy(&f, &mid, sizeof(f));
+                if (encodeExact(f) >= k) hi = mid;
+                else lo = mid + 1;
+            }
+            std::memcpy(&t.threshold[k], &lo, sizeof(float));
+        }
+        t.threshold[256] = std::numeric_limits<float>::infinity();
+
+        t.bucketByte.resize(BUCKETS);
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            std::uint32_t bits = MIN_BITS + static_cast<std::uint32_t>(i << MANTISSA_SHIFT);
+            float f;
+            std::memcpy(&f, &bits, sizeof(f));
+            t.bucketByte[i] = encodeExact(std::min(f, 1.0f));
+        }
+        return t;
+    }
+};
@@ -0,0 +1,231 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include "Parallel.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#define HARDWARE_COUNTERS_SUPPORTED 1
+#else
+#define HARDWARE_COUNTERS_SUPPORTED 0
+#endif
+
+enum class HwPhase {
+    SceneBuild,
+    TraceRows,              // per-pixel Whitted and path tracing
+    WavefrontGenerate,
+    WavefrontIntersect,
+    WavefrontSort,
+    WavefrontShade,
+    WavefrontShadow,
+    WavefrontResolve,
+    Count
+};
+
+// Instructions, cycles, cache misses and branch misses per tracer phase and per thread, from
+// perf_event_open counting groups opened for each thread on first use. Parallel::forEach keeps
+// its helper threads, so a group is opened once per helper rather than inside every measured
+// phase. Each tracer owns its totals, so one tracer's frames never switch off or clear another's.
+// Counting is off until setEnabled(true), and a disabled scope costs one relaxed load.
+class HardwareCounters {
+public:
+    static constexpr size_t EVENTS = 4;     // instructions, cycles, cache misses, branch misses
+    static constexpr size_t MAX_THREADS = 64;
+    static constexpr size_t PHASES = static_cast<size_t>(HwPhase::Count);
+
+    using Values = std::array<std::uint64_t, EVENTS>;
+
+    static bool supported() { return HARDWARE_COUNTERS_SUPPORTED != 0; }
+
+    HardwareCounters() = default;
+    HardwareCounters(const HardwareCounters&) = delete;
+    HardwareCounters& operator=(const HardwareCounters&) = delete;
+
+    void setEnabled(bool on) {
+        enabledFlag.store(on && supported(), std::memory_order_relaxed);
+    }
+
+    bool enabled() const {
+        return enabledFlag.load(std::memory_order_relaxed) && !unavailable().load(std::memory_order_relaxed);
+    }
+
+    void reset() {
+        for (auto& thread : table) {
+            for (auto& phase : thread) {
+                for (auto& v : phase) v.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Counts of the calling thread so far, scaled up when the kernel had to multiplex them
+    static bool read(Values& out) {
+#if HARDWARE_COUNTERS_SUPPORTED
+        Group& g = localGroup();
+        if (g.fds[0] < 0) return false;
+
+        struct {
+            std::uint64_t count;
+            std::uint64_t timeEnabled;
+            std::uint64_t timeRunning;
+            std::uint64_t values[EVENTS];
+        } data;
+        if (::read(g.fds[0], &data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)) || data.timeRunning == 0) return false;
+
+        const double scale = double(data.timeEnabled) / double(data.timeRunning);
+        for (size_t i = 0; i < EVENTS; ++i) out[i] = static_cast<std::uint64_t>(double(data.values[i]) * scale);
+        return true;
+#else
+        (void)out;
+        return false;
+#endif
+    }
+
+    // pool threads have a row each; threads forEach starts outside the pool share the last one
+    void add(HwPhase phase, const Values& begin, const Values& end) {
+        const size_t thread = std::min<size_t>(Parallel::threadIndex(), MAX_THREADS - 1);
+        auto& slot = table[thread][static_cast<size_t>(phase)];
+        for (size_t i = 0; i < EVENTS; ++i) {
+            if (end[i] > begin[i]) slot[i].fetch_add(end[i] - begin[i], std::memory_order_relaxed);
+        }
+    }
+
+    // Every phase that ran since reset(), then its threads when more than one took part
+    void printReport() const {
+        static const char* names[PHASES] = {
+            "scene build", "trace rows", "wavefront generate", "wavefront intersect",
+            "wavefront sort", "wavefront shade", "wavefront shadow", "wavefront resolve"
+        };
+
+        std::cout << "Hardware counters:" << std::endl;
+        if (unavailable().load(std::memory_order_relaxed)) {
+            std::cout << "  unavailable" << std::endl;
+            return;
+        }
+
+        for (size_t p = 0; p < PHASES; ++p) {
+            Values total{};
+            unsigned threads = 0;
+            for (const auto& thread : table) {
+                const Values v = load(thread[p]);
+                if (v[0] == 0) continue;
+                for (size_t i = 0; i < EVENTS; ++i) total[i] += v[i];
+                ++threads;
+            }
+            if (threads == 0) continue;
+
+            std::cout << "  " << names[p] << ": ";
+            printValues(total);
+            if (threads < 2) continue;
+
+            for (size_t t = 0; t < MAX_THREADS; ++t) {
+                const Values v = load(table[t][p]);
+                if (v[0] == 0) continue;
+                std::cout << "    thread " << t << (t == MAX_THREADS - 1 ? "+" : "") << ": ";
+                printValues(v);
+            }
+        }
+    }
+
+private:
+    using Slot = std::array<std::atomic<std::uint64_t>, EVENTS>;
+
+    std::atomic<bool> enabledFlag{ false };
+    std::array<std::array<Slot, PHASES>, MAX_THREADS> table{};
+
+    // set once opening a group failed, e.g. in a container or with perf_event_paranoid > 2
+    static std::atomic<bool>& unavailable() {
+        static std::atomic<bool> flag{ false };
+        return flag;
+    }
+
+    static Values load(const Slot& slot) {
+        Values v;
+        for (size_t i = 0; i < EVENTS; ++i) v[i] = slot[i].load(std::memory_order_relaxed);
+        return v;
+    }
+
+    static void printValues(const Values& v) {
+        const double instructions = double(v[0]);
+        const double kilo = instructions > 0.0 ? instructions / 1000.0 : 1.0;
+        std::cout << instructions * 1e-6 << " M instructions, " << double(v[1]) * 1e-6 << " M cycles, IPC "
+            << (v[1] ? instructions / double(v[1]) : 0.0) << ", cache misses " << double(v[2]) / kilo
+            << " / k instr, branch misses " << double(v[3]) / kilo << " / k instr" << std::endl;
+    }
+
+#if HARDWARE_COUNTERS_SUPPORTED
+    struct Group {
+        int fds[EVENTS] = { -1, -1, -1, -1 };
+
+        Group() {
+            static const std::uint64_t configs[EVENTS] = {
+                PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CPU_CYCLES,
+                PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+            };
+
+            for (size_t i = 0; i < EVENTS; ++i) {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = configs[i];
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+                // this thread, any CPU, one group led by the first counter
+                fds[i] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0));
+                if (fds[i] < 0) {
+                    const int error = errno;
+                    close();
+                    if (!unavailable().exchange(true)) {
+                        std::cerr << "Hardware counters unavailable: " << std::strerror(error)
+                            << " (see /proc/sys/kernel/perf_event_paranoid)" << std::endl;
+                    }
+                    return;
+                }
+            }
+        }
+
+        ~Group() { close(); }
+
+        void close() {
+            for (int& fd : fds) {
+                if (fd >= 0) ::close(fd);
+                fd = -1;
+            }
+        }
+    };
+
+    static Group& localGroup() {
+        thread_local Group group;
+        return group;
+    }
+#endif
+};
+
+class HardwareCounterScope {
+public:
+    HardwareCounterScope(HardwareCounters& counters, HwPhase phase)
+        : counters(counters), phase(phase), active(counters.enabled() && HardwareCounters::read(begin)) {}
+
+    ~HardwareCounterScope() {
+        HardwareCounters::Values end;
+        if (active && HardwareCounters::read(end)) counters.add(phase, begin, end);
+    }
+
+    HardwareCounterScope(const HardwareCounterScope&) = delete;
+    HardwareCounterScope& operator=(const HardwareCounterScope&) = delete;
+
+private:
+    HardwareCounters& counters;
+    HwPhase phase;
+    HardwareCounters::Values begin{};
+    bool active;
+};
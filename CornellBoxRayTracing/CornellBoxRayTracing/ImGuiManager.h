@@ -5,7 +5,14 @@
 #include "Scene.h"
 #include "CornellRoom.h"
 #include "OBJLoader.h"
+#include "RenderStrategy.h"
+#include "OfflineRenderer.h"
+#include "PerfStats.h"
+#include "Trace.h"
+#include "StressScene.h"
+#include "SceneFile.h"
 #include <vector>
+#include <cfloat>
 #include <string>
 #include <iostream>
 
@@ -32,6 +39,59 @@ public:
         ImGui::SFML::Render(window);
     }
 
+    void setPerfStats(const PerfStats* stats) {
+        perfStats = stats;
+    }
+
+    void showPerformanceWindow() {
+        if (!perfStats) return;
+        const PerfStats& p = *perfStats;
+
+        ImGui::Begin("Performance");
+
+        const float frameMs = p.last.total();
+        ImGui::Text("Frame: %.2f ms (%.0f FPS)", frameMs, frameMs > 0.0f ? 1000.0f / frameMs : 0.0f);
+
+        const int history = static_cast<int>(PerfStats::HISTORY);
+        const int offset = static_cast<int>(p.next);
+        const ImVec2 plotSize(0.0f, 40.0f);
+        ImGui::PlotLines("Total", p.total.data(), history, offset, nullptr, 0.0f, FLT_MAX, plotSize);
+        ImGui::PlotLines("Events", p.events.data(), history, offset, nullptr, 0.0f, FLT_MAX, plotSize);
+        ImGui::PlotLines("Update", p.update.data(), history, offset, nullptr, 0.0f, FLT_MAX, plotSize);
+        ImGui::PlotLines("Draw", p.draw.data(), history, offset, nullptr, 0.0f, FLT_MAX, plotSize);
+        ImGui::PlotLines("ImGui", p.imgui.data(), history, offset, nullptr, 0.0f, FLT_MAX, plotSize);
+        ImGui::PlotLines("Present", p.present.data(), history, offset, nullptr, 0.0f, FLT_MAX, plotSize);
+        ImGui::Text("Events %.2f  Update %.2f  Draw %.2f  ImGui %.2f  Present %.2f ms",
+            p.last.events, p.last.update, p.last.draw, p.last.imgui, p.last.present);
+
+        ImGui::Separator();
+        if (p.renderSeconds > 0.0) {
+            ImGui::Text("Last ray traced frame: %.1f ms", p.renderSeconds * 1000.0);
+            ImGui::Text("Primary    %.2f Mrays/s", p.raysPerSecond(RayType::Primary) * 1e-6);
+            ImGui::Text("Reflection %.2f Mrays/s", p.raysPerSecond(RayType::Reflection) * 1e-6);
+            ImGui::Text("Refraction %.2f Mrays/s", p.raysPerSecond(RayType::Refraction) * 1e-6);
+            ImGui::Text("Shadow     %.2f Mrays/s", p.raysPerSecond(RayType::Shadow) * 1e-6);
+            ImGui::Text("Triangle tests per ray: %.1f", p.triangleTestsPerRay());
+            ImGui::Text("Scene build: %.2f ms", p.sceneBuildMs);
+        }
+        else {
+            ImGui::Text("No ray traced frame yet");
+        }
+        ImGui::Text("Memory: meshes %.2f MB, tracer %.2f MB", p.meshBytes / (1024.0 * 1024.0), p.tracerBytes / (1024.0 * 1024.0));
+
+        ImGui::Separator();
+        if (Trace::enabled()) {
+            if (ImGui::Button("Save trace")) Trace::writeJson("trace.json");
+            ImGui::SameLine();
+            ImGui::TextDisabled("Chrome trace JSON, opens in Perfetto");
+        }
+        else {
+            ImGui::TextDisabled("Tracing compiled out (ENABLE_TRACING=0)");
+        }
+
+        ImGui::End();
+    }
+
     void showSceneEditor() {
         ImGui::Begin("Scene Editor");
 
@@ -55,6 +115,16 @@ public:
             ImGui::TreePop();
         }
 
+        if (ImGui::TreeNode("Stress Scene")) {
+            showStressSceneControls();
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("Scene File")) {
+            showSceneFileControls();
+            ImGui::TreePop();
+        }
+
         if (ImGui::Button("Load OBJ Model")) {
             showFileDialog = true;
         }
@@ -77,12 +147,20 @@ public:
 
     bool shouldRenderRayTracing() const { return renderRayTracing; }
     bool shouldReturnToEditing() const { return returnToEditing; }
+    bool shouldRenderOffline() const { return renderOffline; }
     void resetRenderFlags() {
         renderRayTracing = false;
         returnToEditing = false;
+        renderOffline = false;
     }
 
     void setShowRayTracingResult(bool show) { showRayTracingResult = show; }
+    void setRayTracingSettings(RayTracingSettings* settings) { rayTracingSettings = settings; }
+    void setOfflineRenderSettings(OfflineRenderSettings* settings) { offlineSettings = settings; }
+    void setRayTracingProgress(unsigned samples, bool progressive) {
+        accumulatedSamples = samples;
+        progressiveRender = progressive;
+    }
 
 private:
     sf::RenderWindow& window;
@@ -96,6 +174,57 @@ private:
     bool renderRayTracing = false;
     bool returnToEditing = false;
     bool showRayTracingResult = false;
+    RayTracingSettings* rayTracingSettings = nullptr;
+    OfflineRenderSettings* offlineSettings = nullptr;
+    bool renderOffline = false;
+    char offlinePath[256] = "render.ppm";
+    char checkpointPath[256] = "render.ckpt";
+    unsigned accumulatedSamples = 0;
+    bool progressiveRender = false;
+    const PerfStats* perfStats = nullptr;
+    int stressPrimitives = 10000;
+    int stressSeed = 1;
+    int stressLights = 4;
+    char scenePath[256] = "scene.rtscene";
+
+    void showStressSceneControls() {
+        if (ImGui::InputInt("Primitives", &stressPrimitives)) {
+            stressPrimitives = std::clamp(stressPrimitives, 10, 10000000);
+        }
+        ImGui::InputInt("Seed", &stressSeed);
+        ImGui::SliderInt("Lights", &stressLights, 0, 64);
+
+        if (ImGui::Button("Generate")) {
+            StressSceneSettings s;
+            s.primitives = static_cast<size_t>(stressPrimitives);
+            s.seed = static_cast<unsigned>(stressSeed);
+            s.lights = stressLights;
+            if (cornellRoom) s.roomSize = cornellRoom->getRoomSize();
+
+            selectedNode = nullptr;
+            StressScene::populate(scene, s);
+        }
+
+        ImGui::SameLine();
+        if (ImGui::Button("Remove")) {
+            selectedNode = nullptr;
+            StressScene::clear(scene);
+        }
+    }
+
+    void showSceneFileControls() {
+        ImGui::InputText("Scene file", scenePath, sizeof(scenePath));
+
+        if (ImGui::Button("Save")) {
+            SceneFile::save(scene, scenePath);
+        }
+
+        ImGui::SameLine();
+        if (ImGui::Button("Load")) {
+            selectedNode = nullptr;
+            SceneFile::load(scenePath, scene);
+        }
+    }
 
     void showRayTracingControls() {
         if (ImGui::TreeNode("Ray Tracing")) {
@@ -104,13 +233,22 @@ private:
                 ImGui::Text("Scene is in EDITING mode");
                 ImGui::Text("Wireframe view for fast editing");
 
+                showRayTracingSettings();
+
                 if (ImGui::Button("Render with Ray Tracing", ImVec2(200, 40))) {
                     renderRayTracing = true;
                 }
+
+                showOfflineRenderSettings();
             }
             else {
                 ImGui::TextColored(ImVec4(0, 1, 0, 1), "RAY TRACING RESULT");
-                ImGui::Text("High-quality rendering complete");
+                if (progressiveRender && rayTracingSettings) {
+                    ImGui::Text("Path tracing: %u / %d samples per pixel", accumulatedSamples, rayTracingSettings->targetSamples);
+                }
+                else {
+                    ImGui::Text("High-quality rendering complete");
+                }
 
                 if (ImGui::Button("Return to Editing", ImVec2(200, 40))) {
                     returnToEditing = true;
@@ -122,6 +260,136 @@ private:
         }
     }
 
+    void showOfflineRenderSettings() {
+        if (!offlineSettings) return;
+        if (!ImGui::TreeNode("Offline Render")) return;
+
+        auto& s = *offlineSettings;
+        int size[2] = { static_cast<int>(s.width), static_cast<int>(s.height) };
+        if (ImGui::InputInt2("Resolution", size)) {
+            s.width = static_cast<unsigned>(std::clamp(size[0], 1, 65536));
+            s.height = static_cast<unsigned>(std::clamp(size[1], 1, 65536));
+        }
+
+        int band = static_cast<int>(s.bandHeight);
+        if (ImGui::SliderInt("Band height", &band, 1, 256)) {
+            s.bandHeight = static_cast<unsigned>(band);
+        }
+
+        const char* formats[] = { "PPM (8-bit)", "PFM (float, linear)" };
+        int format = static_cast<int>(s.format);
+        if (ImGui::Combo("Format", &format, formats, 2)) {
+            s.format = static_cast<OfflineFormat>(format);
+        }
+
+        int workers = static_cast<int>(s.distributed.workers);
+        if (ImGui::SliderInt("Worker processes (0 = off)", &workers, 0, 64)) {
+            s.distributed.workers = static_cast<unsigned>(workers);
+        }
+        if (s.distributed.workers > 0) {
+            int threads = static_cast<int>(s.distributed.threadsPerWorker);
+            if (ImGui::SliderInt("Threads per worker", &threads, 1, 64)) {
+                s.distributed.threadsPerWorker = static_cast<unsigned>(threads);
+            }
+            int tile = static_cast<int>(s.distributed.tileHeight);
+            if (ImGui::SliderInt("Tile height", &tile, 1, 256)) {
+                s.distributed.tileHeight = static_cast<unsigned>(tile);
+            }
+        }
+
+        ImGui::InputText("Output file", offlinePath, sizeof(offlinePath));
+        ImGui::Text("Uses the settings above; path tracing renders Target samples");
+
+        if (ImGui::Button("Render to File")) {
+            s.path = offlinePath;
+            renderOffline = true;
+        }
+
+        ImGui::TreePop();
+    }
+
+    void showRayTracingSettings() {
+        if (!rayTracingSettings) return;
+        auto& settings = *rayTracingSettings;
+
+        const char* integrators[] = { "Whitted (fast)", "Path tracing (progressive)" };
+        int integrator = static_cast<int>(settings.integrator);
+        if (ImGui::Combo("Integrator", &integrator, integrators, 2)) {
+            settings.integrator = static_cast<Integrator>(integrator);
+        }
+
+        ImGui::Checkbox("Cost heatmap (debug)", &settings.costHeatmap);
+        if (settings.costHeatmap) {
+            const char* metrics[] = { "Rays", "Triangle tests", "Sphere tests", "Traversal steps", "Depth reached" };
+            int metric = static_cast<int>(settings.costMetric);
+            if (ImGui::Combo("Heatmap metric", &metric, metrics, 5)) {
+                settings.costMetric = static_cast<CostMetric>(metric);
+            }
+        }
+
+        if (HardwareCounters::supported()) {
+            ImGui::Checkbox("Hardware counters (printed per frame)", &settings.hardwareCounters);
+        }
+
+        const char* samplers[] = { "Independent random", "Owen-scrambled Sobol", "Sobol + blue-noise offsets" };
+        int sampler = static_cast<int>(settings.sampler);
+        if (ImGui::Combo("Sampler", &sampler, samplers, 3)) {
+            settings.sampler = static_cast<SamplerType>(sampler);
+        }
+
+        if (settings.integrator == Integrator::PathTracing) {
+            ImGui::SliderInt("Samples per frame", &settings.samplesPerFrame, 1, 64);
+            ImGui::SliderInt("Target samples", &settings.targetSamples, 1, 16384);
+            ImGui::SliderInt("Max path depth", &settings.pathMaxDepth, 1, 32);
+            ImGui::SliderInt("Russian roulette from", &settings.rouletteDepth, 1, 16);
+
+            ImGui::Checkbox("Checkpoints (resume after restart)", &settings.checkpoints);
+            if (settings.checkpoints) {
+                if (ImGui::InputText("Checkpoint file", checkpointPath, sizeof(checkpointPath))) {
+                    settings.checkpointPath = checkpointPath;
+                }
+                ImGui::SliderFloat("Checkpoint interval (s)", &settings.checkpointInterval, 1.0f, 600.0f);
+                ImGui::SliderFloat("Max write overhead", &settings.checkpointMaxOverhead, 0.001f, 0.1f);
+            }
+        }
+        else {
+            ImGui::SliderInt("Antialiasing samples", &settings.antialiasingSamples, 1, 64);
+            ImGui::SliderInt("Max ray depth", &settings.maxDepth, 1, 16);
+            ImGui::SliderFloat("Deadline (ms, 0 = off)", &settings.deadlineMs, 0.0f, 2000.0f);
+            ImGui::Checkbox("Wavefront (material-sorted batches)", &settings.wavefront);
+            if (settings.wavefront) {
+                ImGui::SliderInt("Wavefront tile size", &settings.wavefrontTileSize, 16, 512);
+            }
+
+            const char* shadowModes[] = { "Exact shadow rays", "Shadow maps (preview)" };
+            int shadowMode = static_cast<int>(settings.shadowMode);
+            if (ImGui::Combo("Shadows", &shadowMode, shadowModes, 2)) {
+                settings.shadowMode = static_cast<ShadowMode>(shadowMode);
+            }
+
+            if (settings.shadowMode == ShadowMode::ShadowMap) {
+                ImGui::SliderInt("Shadow map size", &settings.shadowMapResolution, 64, 2048);
+                ImGui::SliderInt("Shadow filter radius", &settings.shadowMapFilterRadius, 0, 3);
+                ImGui::Text("Cube maps are rebuilt only when the scene changes");
+            }
+        }
+
+        ImGui::Checkbox("Light tree (many lights)", &settings.useLightTree);
+        if (settings.useLightTree) {
+            ImGui::SliderInt("Max lights per hit", &settings.maxLightsPerHit, 1, 64);
+            ImGui::DragFloat("Light cutoff radius", &settings.lightCutoffRadius, 0.5f, 0.0f, 200.0f);
+            ImGui::Text("Cutoff radius 0 keeps every light");
+        }
+
+        ImGui::Checkbox("Area lights from emissive meshes", &settings.areaLights);
+        if (settings.areaLights) {
+            ImGui::SliderInt("Penumbra samples", &settings.areaLightSamples, 4, 256);
+            ImGui::SliderInt("Probe samples", &settings.areaLightProbes, 1, 16);
+            ImGui::SliderInt("Area lights per hit", &settings.maxAreaLightsPerHit, 1, 16);
+            ImGui::Text("Extra samples are only taken where probes disagree");
+        }
+    }
+
     void showObjectTree(SceneNode* node) {
         bool isSelected = (selectedNode == node);
 
@@ -187,7 +455,7 @@ private:
 
     void showMeshControls(Mesh& mesh) {
         ImGui::Text("Mesh: %s", mesh.name.c_str());
-        ImGui::Text("Faces: %d", mesh.faces.size());
+        ImGui::Text("Faces: %d", mesh.geometry().size());
 
         if (mesh.material.isMirror) {
             ImGui::TextColored(ImVec4(1, 1, 0, 1), "MIRROR SURFACE");
@@ -277,6 +545,18 @@ private:
                 ImGui::Text("Allows light to pass through the object");
             }
 
+            if (ImGui::Checkbox("Emissive (Area Light)", &material.isEmissive)) {
+                if (material.isEmissive && material.emissionStrength == 0.0f) {
+                    material.emissionColor = glm::vec3(1.0f);
+                    material.emissionStrength = 1.5f;
+                }
+            }
+            if (material.isEmissive) {
+                ImGui::ColorEdit3("Emission Color", &material.emissionColor[0]);
+                ImGui::DragFloat("Emission Strength", &material.emissionStrength, 0.05f, 0.0f, 20.0f);
+                ImGui::Text("Casts soft shadows when area lights are enabled");
+            }
+
             if (material.isMirror && material.isTransparent) {
                 ImGui::TextColored(ImVec4(1, 0.5f, 0, 1), "Warning: Glass material (reflective + transparent)");
             }
@@ -363,6 +643,9 @@ private:
         lightNode->light = std::make_unique<Light>(glm::vec3(0.0f, 6.2f, 0.0f), glm::vec3(1.0f, 1.0f, 1.0f), 1.5f );
         lightNode->mesh = createLightMesh();
         lightNode->mesh->position = lightNode->light->position;
+        lightNode->mesh->material.isEmissive = true;
+        lightNode->mesh->material.emissionColor = lightNode->light->color;
+        lightNode->mesh->material.emissionStrength = lightNode->light->intensity;
 
         scene.addLight(lightNode);
         selectedNode = lightNode;
@@ -379,8 +662,13 @@ private:
             }
         }
 
-        ImGui::ColorEdit3("Color", &light.color[0]);
-        ImGui::DragFloat("Intensity", &light.intensity, 0.1f, 0.0f, 10.0f);
+        bool changed = ImGui::ColorEdit3("Color", &light.color[0]);
+        changed |= ImGui::DragFloat("Intensity", &light.intensity, 0.1f, 0.0f, 10.0f);
+
+        if (changed && lightNode.mesh && lightNode.mesh->material.isEmissive) {
+            lightNode.mesh->material.emissionColor = light.color;
+            lightNode.mesh->material.emissionStrength = light.intensity;
+        }
 
         if (ImGui::Button("Delete Light")) {
             deleteLight(lightNode);
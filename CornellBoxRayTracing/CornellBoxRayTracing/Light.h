@@ -13,4 +13,8 @@ struct Light {
         float intens = 1.0f)
         : position(pos), color(col), intensity(intens) {
     }
+
+    static float attenuation(float dist) {
+        return 1.0f / (1.0f + 0.1f * dist + 0.01f * dist * dist);
+    }
 };
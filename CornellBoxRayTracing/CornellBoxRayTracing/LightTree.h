@@ -0,0 +1,168 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include "Light.h"
+
+// A light (or a cluster of lights) chosen to shade one point
+struct ShadingLight {
+    glm::vec3 position{ 0.0f };
+    glm::vec3 radiance{ 0.0f };
+    int lightIndex = -1;
+};
+
+// Binary BVH over point lights. selectLights() returns a lightcut: every light is covered
+// by exactly one entry, clusters are shaded through their brightest light with the summed
+// color * intensity of the cluster, and the cut is refined where the bound on the error is largest.
+class LightTree {
+public:
+    void build(const std::vector<Light>& lights) {
+        nodes.clear();
+        lightCount = lights.size();
+        if (lights.empty()) return;
+
+        std::vector<int> order(lights.size());
+        for (size_t i = 0; i < order.size(); ++i) order[i] = static_cast<int>(i);
+
+        nodes.reserve(lights.size() * 2);
+        buildNode(lights, order, 0, static_cast<int>(order.size()));
+    }
+
+    size_t memoryBytes() const { return nodes.capacity() * sizeof(Node); }
+
+    size_t size() const { return lightCount; }
+    bool empty() const { return lightCount == 0; }
+
+    // maxLights bounds the size of the cut (and therefore the shadow rays per hit);
+    // clusters further than cutoffRadius are dropped when cutoffRadius > 0
+    void selectLights(const glm::vec3& p, int maxLights, float cutoffRadius, std::vector<ShadingLight>& out) const {
+        out.clear();
+        if (nodes.empty()) return;
+
+        thread_local std::vector<Candidate> heap;
+        heap.clear();
+
+        maxLights = std::max(1, maxLights);
+        float estimate = 0.0f;
+
+        auto push = [&](int nodeIndex) {
+            const Node& n = nodes[nodeIndex];
+            float minDist = distanceToBounds(p, n.boundsMin, n.boundsMax);
+            if (cutoffRadius > 0.0f && minDist > cutoffRadius) return;
+
+            Candidate c;
+            c.node = nodeIndex;
+            c.contribution = n.power * Light::attenuation(glm::length(n.position - p));
+            c.error = n.isLeaf() ? 0.0f : n.power * Light::attenuation(minDist);
+            estimate += c.contribution;
+            heap.push_back(c);
+            std::push_heap(heap.begin(), heap.end());
+            };
+
+        push(0);
+
+        while (!heap.empty() && static_cast<int>(heap.size()) < maxLights) {
+            const Candidate& worst = heap.front();
+            if (worst.error <= 0.0f || worst.error < relativeErrorThreshold * estimate) break;
+
+            std::pop_heap(heap.begin(), heap.end());
+            Candidate split = heap.back();
+            heap.pop_back();
+            estimate -= split.contribution;
+
+            push(nodes[split.node].left);
+            push(nodes[split.node].right);
+        }
+
+        out.reserve(heap.size());
+        for (const auto& c : heap) {
+            const Node& n = nodes[c.node];
+            ShadingLight s;
+            s.position = n.position;
+            s.radiance = n.radiance;
+            s.lightIndex = n.representative;
+            out.push_back(s);
+        }
+    }
+
+    float relativeErrorThreshold = 0.02f;
+
+private:
+    struct Node {
+        glm::vec3 boundsMin{ 0.0f };
+        glm::vec3 boundsMax{ 0.0f };
+        glm::vec3 position{ 0.0f };
+        glm::vec3 radiance{ 0.0f };
+        float power = 0.0f;
+        int representative = -1;
+        int left = -1;
+        int right = -1;
+
+        bool isLeaf() const { return left < 0; }
+    };
+
+    struct Candidate {
+        int node = 0;
+        float error = 0.0f;
+        float contribution = 0.0f;
+
+        bool operator<(const Candidate& other) const { return error < other.error; }
+    };
+
+    std::vector<Node> nodes;
+    size_t lightCount = 0;
+
+    static float luminance(const glm::vec3& c) {
+        return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+    }
+
+    static float distanceToBounds(const glm::vec3& p, const glm::vec3& bmin, const glm::vec3& bmax) {
+        glm::vec3 d = glm::max(glm::max(bmin - p, p - bmax), glm::vec3(0.0f));
+        return glm::length(d);
+    }
+
+    int buildNode(const std::vector<Light>& lights, std::vector<int>& order, int begin, int end) {
+        const int index = static_cast<int>(nodes.size());
+        nodes.emplace_back();
+
+        Node node;
+        node.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+        node.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+
+        float brightest = -1.0f;
+        for (int i = begin; i < end; ++i) {
+            const Light& l = lights[order[i]];
+            node.boundsMin = glm::min(node.boundsMin, l.position);
+            node.boundsMax = glm::max(node.boundsMax, l.position);
+
+            glm::vec3 radiance = l.color * l.intensity;
+            node.radiance += radiance;
+
+            float power = luminance(radiance);
+            node.power += power;
+            if (power > brightest) {
+                brightest = power;
+                node.representative = order[i];
+            }
+        }
+        node.position = lights[node.representative].position;
+
+        if (end - begin > 1) {
+            glm::vec3 extent = node.boundsMax - node.boundsMin;
+            int axis = 0;
+            if (extent.y > extent[axis]) axis = 1;
+            if (extent.z > extent[axis]) axis = 2;
+
+            const int mid = begin + (end - begin) / 2;
+            std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                [&](int a, int b) { return lights[a].position[axis] < lights[b].position[axis]; });
+
+            node.left = buildNode(lights, order, begin, mid);
+            node.right = buildNode(lights, order, mid, end);
+        }
+
+        nodes[index] = node;
+        return index;
+    }
+};
@@ -12,4 +12,8 @@ struct Material {
     float transparency = 0.0f;
     bool isTransparent = false;
     float refractiveIndex = 1.0f;
+
+    glm::vec3 emissionColor = glm::vec3(0.0f);
+    float emissionStrength = 0.0f;
+    bool isEmissive = false;
 };
\ No newline at end of file
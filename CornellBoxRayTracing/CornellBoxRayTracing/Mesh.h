@@ -4,7 +4,86 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include "Face.h"
 #include "AffineTransform.h"
+#include "Trace.h"
 #include <string>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+
+// Faces stored flat, one record per face indexing into a single vertex array: the layout of a
+// scene file's geometry block, so loaded meshes read their faces straight from the mapped file.
+// storage keeps whatever holds the arrays alive.
+struct PackedFace {
+    glm::vec3 normal{ 0.0f };
+    glm::vec3 color{ 1.0f };
+    std::uint32_t firstVertex = 0;
+    std::uint32_t vertexCount = 0;
+};
+
+struct PackedGeometry {
+    const PackedFace* faces = nullptr;
+    size_t faceCount = 0;
+    const Vertex* vertices = nullptr;
+    size_t vertexCount = 0;
+    std::shared_ptr<const void> storage;
+};
+
+// A face as code that only reads geometry sees it, whichever way the mesh stores its faces
+struct FaceView {
+    struct Vertices {
+        const Vertex* first = nullptr;
+        size_t count = 0;
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        const Vertex* data() const { return first; }
+        const Vertex& operator[](size_t i) const { return first[i]; }
+        const Vertex* begin() const { return first; }
+        const Vertex* end() const { return first + count; }
+    };
+
+    Vertices vertices;
+    glm::vec3 normal{ 0.0f };
+    glm::vec3 color{ 1.0f };
+};
+
+// The faces of a mesh for reading: its own, a snapshot's shared ones or packed ones
+class MeshGeometry {
+public:
+    explicit MeshGeometry(const std::vector<Face>& faces) : list(&faces) {}
+    explicit MeshGeometry(const PackedGeometry& packed) : packed(&packed) {}
+
+    class Iterator {
+    public:
+        Iterator(const MeshGeometry& geometry, size_t index) : geometry(&geometry), index(index) {}
+        FaceView operator*() const { return (*geometry)[index]; }
+        Iterator& operator++() { ++index; return *this; }
+        bool operator!=(const Iterator& other) const { return index != other.index; }
+
+    private:
+        const MeshGeometry* geometry;
+        size_t index;
+    };
+
+    size_t size() const { return list ? list->size() : packed->faceCount; }
+    bool empty() const { return size() == 0; }
+
+    FaceView operator[](size_t i) const {
+        if (list) {
+            const Face& f = (*list)[i];
+            return FaceView{ { f.vertices.data(), f.vertices.size() }, f.normal, f.color };
+        }
+        const PackedFace& f = packed->faces[i];
+        return FaceView{ { packed->vertices + f.firstVertex, f.vertexCount }, f.normal, f.color };
+    }
+
+    Iterator begin() const { return Iterator(*this, 0); }
+    Iterator end() const { return Iterator(*this, size()); }
+
+private:
+    const std::vector<Face>* list = nullptr;
+    const PackedGeometry* packed = nullptr;
+};
 
 class Mesh {
 public: 
@@ -15,7 +94,43 @@ public:
 	glm::vec3 scale = glm::vec3(1.0);
     Material material;
 
+    // renewed by the methods that rewrite faces, so snapshots and the tracer can tell changed
+    // geometry apart; code writing to faces of a mesh in use must call touchGeometry() first,
+    // which also unpacks packedFaces. Revisions are unique across meshes, and a copy keeps the
+    // one of its source since it has the same faces
+    std::uint64_t geometryRevision = newRevision();
+
+    void touchGeometry() {
+        unpackFaces();
+        geometryRevision = newRevision();
+    }
+
+    // Faces that never change, shared by the snapshot copies of one geometry revision; such
+    // copies leave faces empty. Code that only reads geometry goes through geometry().
+    std::shared_ptr<const std::vector<Face>> sharedFaces;
+
+    // Faces of a mesh loaded from a scene file, read in place until an edit unpacks them into
+    // faces; faces stays empty meanwhile
+    std::shared_ptr<const PackedGeometry> packedFaces;
+
+    MeshGeometry geometry() const {
+        if (sharedFaces) return MeshGeometry(*sharedFaces);
+        if (packedFaces) return MeshGeometry(*packedFaces);
+        return MeshGeometry(faces);
+    }
+
+    size_t memoryBytes() const {
+        if (!sharedFaces && packedFaces) {
+            return packedFaces->faceCount * sizeof(PackedFace) + packedFaces->vertexCount * sizeof(Vertex);
+        }
+        const std::vector<Face>& list = sharedFaces ? *sharedFaces : faces;
+        size_t bytes = list.capacity() * sizeof(Face);
+        for (const auto& face : list) bytes += face.vertices.capacity() * sizeof(Vertex);
+        return bytes;
+    }
+
 	void applyTransform(const glm::mat4& transform) {
+        touchGeometry();
         for (auto& face : faces) {
             for (auto& vertex : face.vertices) {
                 glm::vec4 transformed = transform * glm::vec4(vertex.position, 1.0f);
@@ -54,6 +169,7 @@ public:
 
     void setMaterial(const Material& newMaterial) {
         material = newMaterial;
+        touchGeometry();
         for (auto& face : faces) {
             face.setColor(material.diffuseColor);
         }
@@ -61,18 +177,19 @@ public:
 
     void setColor(const glm::vec3& color) {
         material.diffuseColor = color;
+        touchGeometry();
         for (auto& face : faces) {
             face.setColor(color);
         }
     }
 
     glm::vec3 getCenter() const {
-        if (faces.empty()) return glm::vec3(0.0f);
+        if (geometry().empty()) return glm::vec3(0.0f);
 
         glm::vec3 center(0.0f);
         size_t count = 0;
 
-        for (const auto& face : faces) {
+        for (const auto& face : geometry()) {
             for (const auto& vertex : face.vertices) {
                 center += vertex.position;
                 count++;
@@ -130,6 +247,8 @@ public:
     }
 
     void calculateVertexNormals() {
+        TRACE_SCOPE("Mesh::calculateVertexNormals");
+        touchGeometry();
         std::vector<glm::vec3> uniquePositions;
         std::vector<std::vector<size_t>> vertexToFaces;
 
@@ -283,4 +402,22 @@ public:
         return mesh;
     }
 
+private:
+    void unpackFaces() {
+        if (!packedFaces) return;
+        const PackedGeometry& packed = *packedFaces;
+        faces.resize(packed.faceCount);
+        for (size_t f = 0; f < packed.faceCount; ++f) {
+            const PackedFace& pf = packed.faces[f];
+            faces[f].vertices.assign(packed.vertices + pf.firstVertex, packed.vertices + pf.firstVertex + pf.vertexCount);
+            faces[f].normal = pf.normal;
+            faces[f].color = pf.color;
+        }
+        packedFaces.reset();
+    }
+
+    static std::uint64_t newRevision() {
+        static std::atomic<std::uint64_t> last{ 0 };
+        return ++last;
+    }
 };
\ No newline at end of file
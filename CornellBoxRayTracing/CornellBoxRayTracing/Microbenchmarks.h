@@ -0,0 +1,245 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include "RenderStrategy.h"
+#include "FrameBuffer.h"
+#include "OBJLoader.h"
+
+// Kernel timings over fixed-seed random inputs, each printed as ns per operation and
+// operations per second. Scene kernels (inShadow, shadeDirect) run on hits in the scene
+// passed to run(), the others on synthetic data of realistic size.
+class Microbenchmarks {
+public:
+    // every kernel, or only those whose name contains filter
+    static void run(RayTracingStrategy& tracer, Scene& scene, const std::string& filter = "") {
+        using RT = RayTracingStrategy;
+
+        // point lights, so inShadow and shadeDirect have lights to work with
+        tracer.settings.areaLights = false;
+        if (!tracer.beginFrame(scene, 64, 64)) {
+            std::cerr << "Microbenchmarks need a scene with a camera" << std::endl;
+            return;
+        }
+
+        std::mt19937 rng(20240917u);
+        std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+        auto randomVec = [&]() { return glm::vec3(uniform(rng), uniform(rng), uniform(rng)); };
+        auto randomDir = [&]() {
+            glm::vec3 d;
+            do d = randomVec(); while (glm::dot(d, d) > 1.0f || glm::dot(d, d) < 1e-4f);
+            return glm::normalize(d);
+            };
+
+        std::printf("%-40s %12s %18s\n", "kernel", "ns/op", "throughput");
+
+        // rays aimed at random triangles, about half of them through the triangle
+        struct TriCase { glm::vec3 o, d, v0, v1, v2; };
+        std::vector<TriCase> tris(4096);
+        for (auto& c : tris) {
+            c.v0 = randomVec();
+            c.v1 = randomVec();
+            c.v2 = randomVec();
+            const float u = uniform(rng) * 0.8f + 0.3f;
+            const float v = uniform(rng) * 0.8f + 0.3f;
+            c.o = randomDir() * 4.0f;
+            c.d = glm::normalize(c.v0 + (c.v1 - c.v0) * u * 0.5f + (c.v2 - c.v0) * v * 0.5f - c.o);
+        }
+        measure(filter, "rayTri", "tests", tris.size(), [&]() {
+            float sum = 0.0f;
+            for (const auto& c : tris) {
+                float t, u, v;
+                if (RT::rayTri(c.o, c.d, c.v0, c.v1, c.v2, t, u, v)) sum += t;
+            }
+            return sum;
+            });
+
+        struct SphereCase { glm::vec3 o, d; RT::RTSphere s; };
+        std::vector<SphereCase> spheres(4096);
+        for (auto& c : spheres) {
+            c.s.center = randomVec() * 5.0f;
+            c.s.radius = 0.5f + 0.5f * (uniform(rng) + 1.0f);
+            c.o = c.s.center + randomDir() * 8.0f;
+            c.d = glm::normalize(c.s.center + randomVec() * c.s.radius * 1.5f - c.o);
+        }
+        measure(filter, "intersectSphere", "tests", spheres.size(), [&]() {
+            float sum = 0.0f;
+            for (const auto& c : spheres) {
+                RT::HitInfo hit;
+                if (tracer.intersectSphere(c.o, c.d, c.s, hit)) sum += hit.t;
+            }
+            return sum;
+            });
+
+        // a tessellated object like a loaded model, not named "Sphere" so it stays a mesh
+        Mesh blob = Mesh::createSphereUV(1.0f, 8, 16);
+        blob.name = "Blob";
+        blob.scale = glm::vec3(2.0f);
+        RT::RTMesh rtBlob;
+        rtBlob.mesh = &blob;
+        rtBlob.model = blob.getTransformMatrix();
+        rtBlob.invModel = glm::inverse(rtBlob.model);
+        rtBlob.normalMat = glm::transpose(glm::inverse(glm::mat3(rtBlob.model)));
+        for (const auto& face : blob.faces) {
+            if (face.vertices.size() >= 3) rtBlob.triangleCount += static_cast<std::uint32_t>(face.vertices.size() - 2);
+        }
+
+        std::vector<std::pair<glm::vec3, glm::vec3>> blobRays(1024);
+        for (auto& r : blobRays) {
+            r.first = randomDir() * 8.0f;
+            r.second = glm::normalize(randomVec() * 2.5f - r.first);
+        }
+        const std::string meshName = "intersectMesh (" + std::to_string(rtBlob.triangleCount) + " tris)";
+        measure(filter, meshName.c_str(), "rays", blobRays.size(), [&]() {
+            float sum = 0.0f;
+            for (const auto& r : blobRays) {
+                RT::HitInfo hit;
+                if (tracer.intersectMesh(r.first, r.second, rtBlob, hit)) sum += hit.t;
+            }
+            return sum;
+            });
+
+        // surface points of the scene as seen from its camera
+        const auto& meshes = tracer.frameContext.meshes;
+        const auto& sceneSpheres = tracer.frameContext.spheres;
+        const glm::vec3 eye = tracer.frameContext.view.rayOrigin;
+        std::vector<RT::HitInfo> hits;
+        for (int attempt = 0; attempt < 16384 && hits.size() < 1024; ++attempt) {
+            const glm::vec3 d = tracer.frameContext.view.primaryDir(
+                (uniform(rng) * 0.5f + 0.5f) * 64.0f, (uniform(rng) * 0.5f + 0.5f) * 64.0f);
+            RT::HitInfo hit;
+            if (!tracer.intersectScene(eye, d, meshes, sceneSpheres, hit, true) || hit.hitLight) continue;
+            hit.eye = eye;
+            hits.push_back(hit);
+        }
+
+        if (!hits.empty() && !tracer.lights.empty()) {
+            const glm::vec3 lightPos = tracer.lights[0].position;
+            measure(filter, "inShadow", "rays", hits.size(), [&]() {
+                float sum = 0.0f;
+                for (const auto& hit : hits) {
+                    const glm::vec3 toLight = lightPos - hit.p;
+                    const float dist = glm::length(toLight);
+                    if (!tracer.inShadow(hit.p, hit.nGeom, toLight / dist, dist, meshes, sceneSpheres)) sum += 1.0f;
+                }
+                return sum;
+                });
+
+            measure(filter, "shadeDirect", "hits", hits.size(), [&]() {
+                float sum = 0.0f;
+                for (size_t i = 0; i < hits.size(); ++i) {
+                    Sampler sampler(tracer.settings.sampler, static_cast<std::uint32_t>(i), 0, 0);
+                    sum += tracer.shadeDirect<false>(hits[i], tracer.lights, scene, meshes, sceneSpheres, sampler, 0).r;
+                }
+                return sum;
+                });
+        }
+
+        struct FresnelCase { glm::vec3 i, n; float eta; };
+        std::vector<FresnelCase> fresnel(4096);
+        for (auto& c : fresnel) {
+            c.n = randomDir();
+            c.i = randomDir();
+            if (glm::dot(c.i, c.n) > 0.0f) c.i = -c.i;
+            c.eta = uniform(rng) > 0.0f ? 1.0f / 1.5f : 1.5f;
+        }
+        measure(filter, "schlick + refractVec", "ops", fresnel.size(), [&]() {
+            float sum = 0.0f;
+            for (const auto& c : fresnel) {
+                const float cosTheta = std::clamp(glm::dot(-c.i, c.n), 0.0f, 1.0f);
+                sum += RT::schlick(cosTheta, 1.0f, 1.0f / c.eta);
+                glm::vec3 t;
+                if (RT::refractVec(c.i, c.n, c.eta, t)) sum += t.x;
+            }
+            return sum;
+            });
+
+        // values spread over the range a frame produces, some above 1
+        std::vector<glm::vec3> linear(4096);
+        for (auto& c : linear) c = (randomVec() + 1.0f) * 0.6f;
+        std::vector<std::uint8_t> encoded(linear.size() * 4);
+        measure(filter, "GammaEncoder::encodeRow", "pixels", linear.size(), [&]() {
+            GammaEncoder::encodeRow(linear.data(), linear.size(), encoded.data());
+            return float(encoded[linear.size()]);
+            });
+
+        Mesh normals = Mesh::createSphereUV(1.0f, 16, 32);
+        const std::string normalsName = "calculateVertexNormals (" + std::to_string(normals.faces.size()) + " faces)";
+        measure(filter, normalsName.c_str(), "meshes", 1, [&]() {
+            normals.calculateVertexNormals();
+            return normals.faces[0].vertices[0].normal.x;
+            });
+
+        const std::string objPath = "microbenchmark.obj";
+        if (writeObj(normals, objPath)) {
+            const std::string loadName = "OBJLoader::loadFromFile (" + std::to_string(normals.faces.size()) + " faces)";
+
+            // the loader reports every file it reads
+            std::streambuf* saved = std::cout.rdbuf(nullptr);
+            measure(filter, loadName.c_str(), "files", 1, [&]() {
+                return float(OBJLoader::loadFromFile(objPath).faces.size());
+                });
+            std::cout.rdbuf(saved);
+            std::cout.clear();
+            std::remove(objPath.c_str());
+        }
+    }
+
+private:
+    // fn() runs one batch of opsPerCall operations and returns a value that depends on them
+    template <typename Fn>
+    static void measure(const std::string& filter, const char* name, const char* unit, size_t opsPerCall, Fn&& fn) {
+        using Clock = std::chrono::steady_clock;
+        if (!filter.empty() && std::string(name).find(filter) == std::string::npos) return;
+
+        volatile float sink = fn();
+
+        // enough calls per batch for about 20 ms, then the median of five batches
+        size_t calls = 1;
+        for (;;) {
+            const auto start = Clock::now();
+            for (size_t i = 0; i < calls; ++i) sink = sink + fn();
+            if (Clock::now() - start >= std::chrono::milliseconds(20) || calls >= (size_t(1) << 24)) break;
+            calls *= 2;
+        }
+
+        double nsPerOp[5];
+        for (double& ns : nsPerOp) {
+            const auto start = Clock::now();
+            for (size_t i = 0; i < calls; ++i) sink = sink + fn();
+            ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / double(calls * opsPerCall);
+        }
+        std::sort(nsPerOp, nsPerOp + 5);
+
+        const double perSecond = 1e9 / nsPerOp[2];
+        char throughput[32];
+        if (perSecond >= 1e6) std::snprintf(throughput, sizeof(throughput), "%.2f M%s/s", perSecond * 1e-6, unit);
+        else std::snprintf(throughput, sizeof(throughput), "%.1f %s/s", perSecond, unit);
+
+        std::printf("%-40s %12.2f %18s\n", name, nsPerOp[2], throughput);
+        std::fflush(stdout);
+    }
+
+    static bool writeObj(const Mesh& mesh, const std::string& path) {
+        std::ofstream out(path);
+        if (!out) return false;
+
+        size_t next = 1;
+        for (const auto& face : mesh.faces) {
+            for (const auto& v : face.vertices) {
+                out << "v " << v.position.x << " " << v.position.y << " " << v.position.z << "\n";
+                out << "vn " << v.normal.x << " " << v.normal.y << " " << v.normal.z << "\n";
+            }
+            out << "f";
+            for (size_t i = 0; i < face.vertices.size(); ++i, ++next) out << " " << next << "//" << next;
+            out << "\n";
+        }
+        return static_cast<bool>(out);
+    }
+};
@@ -10,6 +10,7 @@
 class OBJLoader {
 public:
     static Mesh loadFromFile(const std::string& filename) {
+        TRACE_SCOPE("OBJLoader::loadFromFile");
         Mesh mesh;
         mesh.name = filename;
 
@@ -0,0 +1,242 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include "RenderStrategy.h"
+#include "FrameBuffer.h"
+#include "DistributedRenderer.h"
+
+enum class OfflineFormat {
+    PPM,    // 8-bit, gamma encoded like the window output
+    PFM     // 32-bit float linear RGB
+};
+
+struct OfflineRenderSettings {
+    unsigned width = 3840;
+    unsigned height = 2160;
+    unsigned bandHeight = 32;
+    OfflineFormat format = OfflineFormat::PPM;
+    std::string path = "render.ppm";
+    DistributedRenderSettings distributed;
+};
+
+// Renders an image of any size independent of the window. Horizontal bands are traced one
+// after another and appended to the file as soon as they finish, so memory holds a single
+// band instead of the whole frame. PFM stores rows bottom to top, so its bands run upwards.
+// Worker processes deliver their bands in the same order, holding back only a bounded number
+// that finished early.
+class OfflineRenderer {
+public:
+    // progress(rowsDone, totalRows) after every band; returns false on I/O errors
+    template <typename ProgressFn>
+    static bool render(RayTracingStrategy& tracer, const Scene& scene, const OfflineRenderSettings& s, ProgressFn&& progress) {
+        if (s.width == 0 || s.height == 0) return false;
+
+        std::ofstream out(s.path, std::ios::binary);
+        if (!out) {
+            std::cerr << "Cannot open file: " << s.path << std::endl;
+            return false;
+        }
+
+        if (s.distributed.workers > 0) {
+            return renderDistributed(tracer, scene, s, out, progress);
+        }
+
+        if (!tracer.beginFrame(scene, s.width, s.height)) {
+            std::cerr << "Offline render needs a camera" << std::endl;
+            return false;
+        }
+
+        const bool pfm = s.format == OfflineFormat::PFM;
+        writeHeader(out, s);
+
+        const unsigned band = std::max(1u, s.bandHeight);
+        const unsigned bandCount = (s.height + band - 1) / band;
+
+        std::vector<glm::vec3> colors;
+        std::vector<std::uint8_t> bytes;
+        std::vector<float> floats;
+
+        auto start = std::chrono::steady_clock::now();
+        unsigned rowsDone = 0;
+
+        for (unsigned b = 0; b < bandCount; ++b) {
+            const unsigned index = pfm ? bandCount - 1 - b : b;
+            const unsigned y0 = index * band;
+            const unsigned y1 = std::min(s.height, y0 + band);
+
+            tracer.renderRows(scene, y0, y1, colors);
+
+            for (unsigned r = 0; r < y1 - y0; ++r) {
+                const unsigned row = pfm ? (y1 - y0 - 1 - r) : r;
+                writeRow(out, colors.data() + size_t(row) * s.width, s.width, pfm, bytes, floats);
+            }
+
+            if (!out) {
+                std::cerr << "Write failed: " << s.path << std::endl;
+                return false;
+            }
+
+            rowsDone += y1 - y0;
+            progress(rowsDone, s.height);
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Offline render: " << s.width << "x" << s.height << " written to " << s.path
+            << " in " << seconds << " s" << std::endl;
+        if (tracer.settings.hardwareCounters) tracer.getHardwareCounters().printReport();
+        return true;
+    }
+
+    static bool render(RayTracingStrategy& tracer, const Scene& scene, const OfflineRenderSettings& s) {
+        return render(tracer, scene, s, [](unsigned, unsigned) {});
+    }
+
+    // Every camera from one scene build; view i is written to s.path with "_i" inserted before
+    // the extension, as soon as its last tile is done
+    static bool renderViews(RayTracingStrategy& tracer, const Scene& scene, const std::vector<Camera>& cameras, const OfflineRenderSettings& s) {
+        if (s.width == 0 || s.height == 0) return false;
+
+        const size_t dot = s.path.find_last_of('.');
+        const size_t slash = s.path.find_last_of("/\\");
+        const bool hasExtension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+        const std::string stem = hasExtension ? s.path.substr(0, dot) : s.path;
+        const std::string extension = hasExtension ? s.path.substr(dot) : std::string();
+        const bool pfm = s.format == OfflineFormat::PFM;
+
+        auto start = std::chrono::steady_clock::now();
+        std::atomic<bool> failed{ false };
+
+        bool rendered = tracer.renderViews(scene, cameras, s.width, s.height, [&](size_t index, const std::vector<glm::vec3>& image) {
+            const std::string path = stem + "_" + std::to_string(index) + extension;
+            std::ofstream out(path, std::ios::binary);
+            writeHeader(out, s);
+
+            std::vector<std::uint8_t> bytes;
+            std::vector<float> floats;
+            for (unsigned r = 0; r < s.height; ++r) {
+                const unsigned row = pfm ? s.height - 1 - r : r;
+                writeRow(out, image.data() + size_t(row) * s.width, s.width, pfm, bytes, floats);
+            }
+            if (!out) {
+                std::cerr << "Write failed: " << path << std::endl;
+                failed = true;
+            }
+            });
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Offline render: " << cameras.size() << " views of " << s.width << "x" << s.height
+            << " in " << seconds << " s" << std::endl;
+        return rendered && !failed;
+    }
+
+    // One camera per line, "x,y,z x,y,z [fov]" for position, target and field of view; blank
+    // lines and lines starting with # are skipped. The rest of each camera is copied from base.
+    static bool readViews(const std::string& path, const Camera& base, std::vector<Camera>& cameras) {
+        std::ifstream in(path);
+        if (!in) {
+            std::cerr << "Cannot open views file: " << path << std::endl;
+            return false;
+        }
+
+        std::string line;
+        for (unsigned number = 1; std::getline(in, line); ++number) {
+            std::istringstream fields(line);
+            std::string position, target;
+            if (!(fields >> position) || position[0] == '#') continue;
+
+            Camera camera = base;
+            std::string fov;
+            bool ok = (fields >> target) && parseVec3(position, camera.position) && parseVec3(target, camera.target);
+            if (ok && fields >> fov) {
+                try { camera.fov = std::stof(fov); } catch (const std::exception&) { camera.fov = 0.0f; }
+                ok = camera.fov > 0.0f && camera.fov < 180.0f;
+            }
+            if (!ok) {
+                std::cerr << path << ":" << number << ": expected x,y,z x,y,z [fov]" << std::endl;
+                return false;
+            }
+            cameras.push_back(camera);
+        }
+
+        if (cameras.empty()) {
+            std::cerr << "No cameras in views file: " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static bool parseVec3(const std::string& text, glm::vec3& out) {
+        char c1 = 0, c2 = 0;
+        std::istringstream in(text);
+        return static_cast<bool>(in >> out.x >> c1 >> out.y >> c2 >> out.z) && c1 == ',' && c2 == ',';
+    }
+
+    template <typename ProgressFn>
+    static bool renderDistributed(RayTracingStrategy& tracer, const Scene& scene, const OfflineRenderSettings& s, std::ofstream& out, ProgressFn& progress) {
+        const bool pfm = s.format == OfflineFormat::PFM;
+        writeHeader(out, s);
+
+        std::vector<std::uint8_t> bytes;
+        std::vector<float> floats;
+        auto writeBand = [&](unsigned y0, unsigned y1, const glm::vec3* colors) {
+            for (unsigned r = 0; r < y1 - y0; ++r) {
+                const unsigned row = pfm ? (y1 - y0 - 1 - r) : r;
+                writeRow(out, colors + size_t(row) * s.width, s.width, pfm, bytes, floats);
+            }
+            };
+
+        if (!DistributedRenderer::render(tracer, scene, s.width, s.height, pfm, s.distributed, writeBand, progress)) {
+            std::cerr << "Offline render needs a camera" << std::endl;
+            return false;
+        }
+
+        if (!out) {
+            std::cerr << "Write failed: " << s.path << std::endl;
+            return false;
+        }
+        std::cout << "Offline render: " << s.width << "x" << s.height << " written to " << s.path << std::endl;
+        return true;
+    }
+
+    static void writeHeader(std::ofstream& out, const OfflineRenderSettings& s) {
+        if (s.format == OfflineFormat::PFM) {
+            // negative scale = little endian
+            out << "PF\n" << s.width << " " << s.height << "\n-1.0\n";
+        }
+        else {
+            out << "P6\n" << s.width << " " << s.height << "\n255\n";
+        }
+    }
+
+    static void writeRow(std::ofstream& out, const glm::vec3* src, unsigned width, bool pfm,
+        std::vector<std::uint8_t>& bytes, std::vector<float>& floats)
+    {
+        if (pfm) {
+            floats.resize(size_t(width) * 3);
+            for (unsigned x = 0; x < width; ++x) {
+                floats[3 * x + 0] = src[x].r;
+                floats[3 * x + 1] = src[x].g;
+                floats[3 * x + 2] = src[x].b;
+            }
+            out.write(reinterpret_cast<const char*>(floats.data()), floats.size() * sizeof(float));
+        }
+        else {
+            bytes.resize(size_t(width) * 3);
+            for (unsigned x = 0; x < width; ++x) {
+                bytes[3 * x + 0] = GammaEncoder::encode(src[x].r);
+                bytes[3 * x + 1] = GammaEncoder::encode(src[x].g);
+                bytes[3 * x + 2] = GammaEncoder::encode(src[x].b);
+            }
+            out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        }
+    }
+};
@@ -0,0 +1,161 @@
+#pragma once
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class Parallel {
+public:
+    static unsigned defaultThreadCount() {
+        const unsigned count = std::max(1u, std::thread::hardware_concurrency());
+        return threadLimit() > 0 ? std::min(count, threadLimit()) : count;
+    }
+
+    // caps defaultThreadCount() for this process, e.g. in worker processes sharing
+    // the machine with others; 0 removes the cap
+    static void setThreadLimit(unsigned limit) {
+        threadLimit() = limit;
+    }
+
+    // 0 on the thread that called forEach, t on the pool's t-th helper thread. Helpers are kept
+    // between calls, so per-thread state such as hardware counter groups is set up once.
+    // Threads started when the pool is busy get FALLBACK_INDEX and up, never a helper's index.
+    static constexpr unsigned FALLBACK_INDEX = 1u << 16;
+
+    static unsigned threadIndex() {
+        return currentIndex();
+    }
+
+    // body(i) for every i in [0, count); indices are handed out dynamically. Runs on the
+    // pool's threads, or on threads of its own when the pool is busy with another call,
+    // e.g. a nested one or one from a second render thread.
+    template <typename Body>
+    static void forEach(size_t count, Body&& body, unsigned threadCount = 0) {
+        if (count == 0) return;
+        if (threadCount == 0) threadCount = defaultThreadCount();
+        threadCount = static_cast<unsigned>(std::min<size_t>(std::min(threadCount, FALLBACK_INDEX), count));
+
+        if (threadCount <= 1) {
+            for (size_t i = 0; i < count; ++i) body(i);
+            return;
+        }
+
+        std::atomic<size_t> next{ 0 };
+        auto worker = [&]() {
+            for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+                body(i);
+            }
+            };
+
+        // a nested call from pool work must not touch busy: its caller may be the thread holding it
+        if (!insidePool()) {
+            Pool& p = pool();
+            std::unique_lock<std::mutex> owner(p.busy, std::try_to_lock);
+            if (owner) {
+                p.run(threadCount - 1, worker);
+                return;
+            }
+        }
+
+        static std::atomic<unsigned> nextFallback{ 0 };
+        std::vector<std::thread> threads;
+        threads.reserve(threadCount - 1);
+        for (unsigned t = 1; t < threadCount; ++t) {
+            const unsigned index = FALLBACK_INDEX + nextFallback.fetch_add(1, std::memory_order_relaxed) % FALLBACK_INDEX;
+            threads.emplace_back([&worker, index]() {
+                currentIndex() = index;
+                worker();
+                });
+        }
+        worker();
+
+        for (auto& th : threads) th.join();
+    }
+
+private:
+    // Helper threads that wait for the next forEach until the process exits
+    class Pool {
+    public:
+        std::mutex busy;    // held by the forEach using the pool
+
+        // job on the calling thread and on helpers 1..helpers, returning when all are done
+        void run(unsigned helpers, const std::function<void()>& work) {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                while (threads.size() < helpers) {
+                    const unsigned index = static_cast<unsigned>(threads.size()) + 1;
+                    threads.emplace_back([this, index]() { loop(index); });
+                }
+                job = &work;
+                participants = helpers;
+                running = helpers;
+                ++generation;
+            }
+            wake.notify_all();
+
+            insidePool() = true;
+            work();
+            insidePool() = false;
+
+            std::unique_lock<std::mutex> lock(m);
+            done.wait(lock, [&]() { return running == 0; });
+            job = nullptr;
+        }
+
+    private:
+        std::mutex m;
+        std::condition_variable wake;
+        std::condition_variable done;
+        std::vector<std::thread> threads;
+        const std::function<void()>* job = nullptr;
+        std::uint64_t generation = 0;
+        unsigned participants = 0;
+        unsigned running = 0;
+
+        void loop(unsigned index) {
+            currentIndex() = index;
+            insidePool() = true;
+            std::uint64_t seen = 0;
+            std::unique_lock<std::mutex> lock(m);
+            for (;;) {
+                wake.wait(lock, [&]() { return generation != seen; });
+                seen = generation;
+                if (index > participants) continue;
+
+                const std::function<void()>* work = job;
+                lock.unlock();
+                (*work)();
+                lock.lock();
+                if (--running == 0) done.notify_all();
+            }
+        }
+    };
+
+    // never destroyed: helpers are still waiting in it while statics are torn down at exit,
+    // and joining them there would run their thread_local destructors against dead statics
+    static Pool& pool() {
+        static Pool* p = new Pool();
+        return *p;
+    }
+
+    static unsigned& currentIndex() {
+        thread_local unsigned index = 0;
+        return index;
+    }
+
+    // set on a thread while it runs work handed to the pool
+    static bool& insidePool() {
+        thread_local bool inside = false;
+        return inside;
+    }
+
+    static unsigned& threadLimit() {
+        static unsigned limit = 0;
+        return limit;
+    }
+};
@@ -0,0 +1,127 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+enum class RayType {
+    Primary,
+    Reflection,
+    Refraction,
+    Shadow,
+    Count
+};
+
+// Process-wide ray counters that can stay on. Each thread adds to one of a fixed set of
+// cache-line sized slots, picked the first time it counts, with relaxed atomic adds; readers
+// sum the slots. Threads sharing a slot only cost a little contention, never a lost count.
+class RayCounters {
+public:
+    struct Totals {
+        std::array<std::uint64_t, static_cast<size_t>(RayType::Count)> rays{};
+        std::uint64_t triangleTests = 0;
+
+        std::uint64_t operator[](RayType type) const { return rays[static_cast<size_t>(type)]; }
+
+        std::uint64_t totalRays() const {
+            std::uint64_t total = 0;
+            for (auto n : rays) total += n;
+            return total;
+        }
+
+        Totals operator-(const Totals& earlier) const {
+            Totals d;
+            for (size_t i = 0; i < rays.size(); ++i) d.rays[i] = rays[i] - earlier.rays[i];
+            d.triangleTests = triangleTests - earlier.triangleTests;
+            return d;
+        }
+    };
+
+    static void add(RayType type, std::uint64_t count = 1) {
+        local().rays[static_cast<size_t>(type)].fetch_add(count, std::memory_order_relaxed);
+    }
+
+    static void addTriangleTests(std::uint64_t count) {
+        if (count) local().triangleTests.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    static Totals read() {
+        Totals t;
+        for (const Slot& slot : slots()) {
+            for (size_t i = 0; i < t.rays.size(); ++i) t.rays[i] += slot.rays[i].load(std::memory_order_relaxed);
+            t.triangleTests += slot.triangleTests.load(std::memory_order_relaxed);
+        }
+        return t;
+    }
+
+private:
+    static constexpr size_t SLOTS = 64;
+
+    struct alignas(64) Slot {
+        std::array<std::atomic<std::uint64_t>, static_cast<size_t>(RayType::Count)> rays{};
+        std::atomic<std::uint64_t> triangleTests{ 0 };
+    };
+
+    static std::array<Slot, SLOTS>& slots() {
+        static std::array<Slot, SLOTS> s;
+        return s;
+    }
+
+    static Slot& local() {
+        static std::atomic<size_t> nextSlot{ 0 };
+        thread_local Slot& slot = slots()[nextSlot.fetch_add(1, std::memory_order_relaxed) % SLOTS];
+        return slot;
+    }
+};
+
+// Where one frame of Application::run went, in milliseconds
+struct FrameTimings {
+    float events = 0.0f;
+    float update = 0.0f;
+    float draw = 0.0f;      // wireframe or ray tracing result, including tracing itself
+    float imgui = 0.0f;
+    float present = 0.0f;
+
+    float total() const { return events + update + draw + imgui + present; }
+};
+
+struct PerfStats {
+    static constexpr size_t HISTORY = 240;
+
+    // ring buffers, one per phase, in the layout ImGui::PlotLines takes
+    std::array<float, HISTORY> events{};
+    std::array<float, HISTORY> update{};
+    std::array<float, HISTORY> draw{};
+    std::array<float, HISTORY> imgui{};
+    std::array<float, HISTORY> present{};
+    std::array<float, HISTORY> total{};
+    size_t next = 0;
+    FrameTimings last;
+
+    // last ray traced frame
+    double renderSeconds = 0.0;
+    RayCounters::Totals renderRays;
+    double sceneBuildMs = 0.0;
+    size_t meshBytes = 0;
+    size_t tracerBytes = 0;
+
+    void addFrame(const FrameTimings& t) {
+        events[next] = t.events;
+        update[next] = t.update;
+        draw[next] = t.draw;
+        imgui[next] = t.imgui;
+        present[next] = t.present;
+        total[next] = t.total();
+        next = (next + 1) % HISTORY;
+        last = t;
+    }
+
+    double raysPerSecond(RayType type) const {
+        return renderSeconds > 0.0 ? double(renderRays[type]) / renderSeconds : 0.0;
+    }
+
+    double triangleTestsPerRay() const {
+        const std::uint64_t rays = renderRays.totalRays();
+        return rays ? double(renderRays.triangleTests) / double(rays) : 0.0;
+    }
+};
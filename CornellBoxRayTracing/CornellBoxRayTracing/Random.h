@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+
+// PCG32 (O'Neill). Each stream id gives an independent sequence, so every pixel
+// can own one and results do not depend on which thread renders it.
+class Pcg32 {
+public:
+    Pcg32(std::uint64_t seed = 0x853c49e6748fea9bull, std::uint64_t stream = 0xda3e39cb94b95bdbull) {
+        state = 0u;
+        inc = (stream << 1u) | 1u;
+        nextUint();
+        state += seed;
+        nextUint();
+    }
+
+    std::uint32_t nextUint() {
+        std::uint64_t old = state;
+        state = old * 6364136223846793005ull + inc;
+        std::uint32_t xorshifted = static_cast<std::uint32_t>(((old >> 18u) ^ old) >> 27u);
+        std::uint32_t rot = static_cast<std::uint32_t>(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31u));
+    }
+
+    // uniform in [0, 1)
+    float nextFloat() {
+        return static_cast<float>(nextUint() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    static std::uint64_t mix64(std::uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return x;
+    }
+
+private:
+    std::uint64_t state;
+    std::uint64_t inc;
+};
@@ -0,0 +1,266 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <algorithm>
+#include <map>
+#include <cstdlib>
+#include <cstdint>
+#include "RenderStrategy.h"
+#include "FrameBuffer.h"
+#include "Parallel.h"
+
+struct RegressionSettings {
+    unsigned width = 160;
+    unsigned height = 120;
+    unsigned repetitions = 3;            // timed frames per case, the median is compared
+    std::string directory = "../golden"; // <directory>/<case>.ppm, committed with the sources
+    std::string timing;                  // this machine's frame times, empty to skip timing
+    bool update = false;                 // write the golden images and timings instead of comparing
+    int channelTolerance = 2;            // per channel, in 8-bit steps
+    double maxDifferentShare = 0.001;    // of the pixels, beyond channelTolerance
+    double timeTolerance = 0.10;         // a median this much slower than the recorded one fails
+};
+
+// Renders reference cases and fails when the image drifts from the golden files. Each case is
+// first rendered on one thread and then with every thread and, for Whitted cases, through the
+// wavefront renderer with small and large tiles; all of these must be bitwise identical, since
+// samples are a function of the pixel and each pixel's samples are summed in sample order no
+// matter which thread traces it.
+//
+// Frame times depend on the machine, so they are not part of the golden files. With a timing
+// file, each case's median is compared with the one recorded there, and cases the file does
+// not have yet are added to it.
+class RegressionTest {
+public:
+    explicit RegressionTest(const RegressionSettings& settings) : s(settings) {
+        if (!s.timing.empty()) readTimings();
+    }
+
+    void run(const std::string& caseName, Scene& scene, const RayTracingSettings& tracerSettings) {
+        bool ok = true;
+        const FrameBuffer reference = render(scene, tracerSettings, 1);
+
+        std::vector<std::pair<std::string, RayTracingSettings>> variants;
+        variants.push_back({ "all threads", tracerSettings });
+        if (tracerSettings.integrator == Integrator::Whitted) {
+            RayTracingSettings wavefront = tracerSettings;
+            wavefront.wavefront = true;
+            for (int tile : { 16, 128 }) {
+                wavefront.wavefrontTileSize = tile;
+                variants.push_back({ "wavefront, tile " + std::to_string(tile), wavefront });
+            }
+        }
+        for (const auto& variant : variants) {
+            if (render(scene, variant.second, 0).pixels != reference.pixels) {
+                std::cout << "  " << caseName << ": differs from the single-threaded image with " << variant.first << std::endl;
+                ok = false;
+            }
+        }
+
+        if (!s.timing.empty()) ok = checkTime(caseName, medianFrameMs(scene, tracerSettings)) && ok;
+        const std::string path = s.directory + "/" + caseName + ".ppm";
+
+        if (s.update) {
+            std::error_code ec;
+            std::filesystem::create_directories(s.directory, ec);
+            if (!writeGolden(path, reference)) {
+                std::cerr << "Cannot write golden image: " << path << std::endl;
+                ok = false;
+            }
+            else {
+                std::cout << "  " << caseName << ": golden image written" << std::endl;
+            }
+            failed = failed || !ok;
+            return;
+        }
+
+        FrameBuffer golden;
+        if (!readGolden(path, golden)) {
+            std::cout << "  " << caseName << ": no golden image at " << path << " (run with --update)" << std::endl;
+            failed = true;
+            return;
+        }
+
+        if (golden.width != reference.width || golden.height != reference.height) {
+            std::cout << "  " << caseName << ": golden image is " << golden.width << "x" << golden.height << std::endl;
+            ok = false;
+        }
+        else {
+            int maxDiff = 0;
+            size_t different = 0;
+            for (size_t i = 0; i < reference.pixels.size(); i += 4) {
+                int pixelDiff = 0;
+                for (size_t c = 0; c < 3; ++c) {
+                    pixelDiff = std::max(pixelDiff, std::abs(int(reference.pixels[i + c]) - int(golden.pixels[i + c])));
+                }
+                maxDiff = std::max(maxDiff, pixelDiff);
+                if (pixelDiff > s.channelTolerance) ++different;
+            }
+
+            const size_t allowed = static_cast<size_t>(s.maxDifferentShare * double(reference.pixels.size() / 4));
+            const bool imageOk = different <= allowed;
+            ok = ok && imageOk;
+            std::cout << "  " << caseName << ": " << different << " pixels differ (max " << maxDiff << ")"
+                << (imageOk ? "" : " IMAGE DRIFT") << std::endl;
+        }
+        failed = failed || !ok;
+    }
+
+    // Renders all cameras in one renderViews() batch and each of them alone through
+    // beginFrame() and renderRows(); every view must match its single render bit for bit
+    void runViews(const std::string& caseName, Scene& scene, const RayTracingSettings& tracerSettings, const std::vector<Camera>& cameras) {
+        RayTracingStrategy tracer;
+        tracer.settings = tracerSettings;
+
+        std::vector<std::vector<glm::vec3>> batch(cameras.size());
+        tracer.renderViews(scene, cameras, s.width, s.height, [&](size_t index, const std::vector<glm::vec3>& image) {
+            batch[index] = image;
+            });
+
+        auto* camera = scene.getCamera();
+        const Camera saved = *camera;
+        size_t different = 0;
+        std::vector<glm::vec3> single;
+        for (size_t v = 0; v < cameras.size(); ++v) {
+            *camera = cameras[v];
+            RayTracingStrategy alone;
+            alone.settings = tracerSettings;
+            alone.beginFrame(scene, s.width, s.height);
+            alone.renderRows(scene, 0, s.height, single);
+            if (single != batch[v]) ++different;
+        }
+        *camera = saved;
+
+        std::cout << "  " << caseName << ": " << different << " of " << cameras.size()
+            << " batched views differ from single renders" << std::endl;
+        failed = failed || different > 0;
+    }
+
+    // the exit code for main()
+    int finish() const {
+        if (timingsChanged && !writeTimings()) {
+            std::cerr << "Cannot write frame times: " << s.timing << std::endl;
+            return 1;
+        }
+        std::cout << (failed ? "Regression test failed" : "Regression test passed") << std::endl;
+        return failed ? 1 : 0;
+    }
+
+private:
+    RegressionSettings s;
+    bool failed = false;
+    std::map<std::string, double> timings;  // median frame ms per case, from s.timing
+    bool timingsChanged = false;
+
+    // a fresh tracer each time, so path traced cases start from an empty accumulation
+    FrameBuffer render(Scene& scene, const RayTracingSettings& tracerSettings, unsigned threads) const {
+        RayTracingStrategy tracer;
+        tracer.settings = tracerSettings;
+        FrameBuffer frame;
+        frame.resize(s.width, s.height);
+
+        Parallel::setThreadLimit(threads);
+        tracer.render(frame, scene);
+        Parallel::setThreadLimit(0);
+        return frame;
+    }
+
+    double medianFrameMs(Scene& scene, const RayTracingSettings& tracerSettings) const {
+        std::vector<double> times;
+        for (unsigned i = 0; i < std::max(1u, s.repetitions); ++i) {
+            const auto start = std::chrono::steady_clock::now();
+            render(scene, tracerSettings, 0);
+            times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        std::sort(times.begin(), times.end());
+        return times[times.size() / 2];
+    }
+
+    // against the recorded time, or recorded when there is none yet or on --update
+    bool checkTime(const std::string& caseName, double frameMs) {
+        auto it = timings.find(caseName);
+        if (s.update || it == timings.end()) {
+            timings[caseName] = frameMs;
+            timingsChanged = true;
+            std::cout << "  " << caseName << ": " << frameMs << " ms recorded" << std::endl;
+            return true;
+        }
+
+        const bool timeOk = frameMs / it->second <= 1.0 + s.timeTolerance;
+        std::cout << "  " << caseName << ": " << it->second << " -> " << frameMs << " ms"
+            << (timeOk ? "" : " TIME REGRESSION") << std::endl;
+        return timeOk;
+    }
+
+    // "<case> <median ms>" per line; a missing file is an empty one
+    void readTimings() {
+        std::ifstream in(s.timing);
+        std::string name;
+        double ms = 0.0;
+        while (in >> name >> ms) {
+            if (ms > 0.0) timings[name] = ms;
+        }
+    }
+
+    bool writeTimings() const {
+        std::ofstream out(s.timing);
+        for (const auto& entry : timings) out << entry.first << " " << entry.second << "\n";
+        return static_cast<bool>(out);
+    }
+
+    static bool writeGolden(const std::string& path, const FrameBuffer& frame) {
+        std::ofstream out(path, std::ios::binary);
+        if (!out) return false;
+
+        out << "P6\n" << frame.width << " " << frame.height << "\n255\n";
+        std::vector<std::uint8_t> rgb(size_t(frame.width) * 3);
+        for (unsigned y = 0; y < frame.height; ++y) {
+            const std::uint8_t* row = frame.row(y);
+            for (unsigned x = 0; x < frame.width; ++x) {
+                rgb[3 * x + 0] = row[4 * x + 0];
+                rgb[3 * x + 1] = row[4 * x + 1];
+                rgb[3 * x + 2] = row[4 * x + 2];
+            }
+            out.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+        }
+        return static_cast<bool>(out);
+    }
+
+    // Binary PPM
+    static bool readGolden(const std::string& path, FrameBuffer& frame) {
+        std::ifstream in(path, std::ios::binary);
+        std::string magic;
+        if (!in || !(in >> magic) || magic != "P6") return false;
+
+        // width, height and maxval, with comment lines allowed in between
+        unsigned values[3] = {};
+        for (unsigned& value : values) {
+            in >> std::ws;
+            while (in.peek() == '#') {
+                std::string comment;
+                std::getline(in, comment);
+                in >> std::ws;
+            }
+            if (!(in >> value)) return false;
+        }
+        if (values[2] != 255 || values[0] == 0 || values[1] == 0) return false;
+        in.get();
+
+        frame.resize(values[0], values[1]);
+        std::vector<std::uint8_t> rgb(size_t(frame.width) * 3);
+        for (unsigned y = 0; y < frame.height; ++y) {
+            if (!in.read(reinterpret_cast<char*>(rgb.data()), rgb.size())) return false;
+            std::uint8_t* row = frame.row(y);
+            for (unsigned x = 0; x < frame.width; ++x) {
+                row[4 * x + 0] = rgb[3 * x + 0];
+                row[4 * x + 1] = rgb[3 * x + 1];
+                row[4 * x + 2] = rgb[3 * x + 2];
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,510 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <queue>
+#include <map>
+#include <sstream>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include "Scene.h"
+#include "RenderStrategy.h"
+#include "FrameBuffer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#define RENDER_SERVER_SUPPORTED 1
+#else
+#define RENDER_SERVER_SUPPORTED 0
+#endif
+
+// Long-lived render service over a UNIX domain socket. The scene and the tracer stay in memory
+// between requests, so the light tree, shadow maps and sampler tables are only rebuilt when a
+// request changes what they depend on. Requests and replies are text lines:
+//
+//   render id=<n> [priority=<n>] [width=<n>] [height=<n>] [samples=<n>] [integrator=whitted|pt]
+//          [format=rgba8|rgb32f] [camera=x,y,z] [target=x,y,z] [fov=<deg>]
+//          [move=<mesh>:x,y,z] [rotate=<mesh>:x,y,z] [scale=<mesh>:x,y,z] [color=<mesh>:r,g,b]
+//          [persist=0|1]
+//   release shm=<name>
+//   shutdown
+//
+//   done id=<n> shm=<name> width=<n> height=<n> format=<f> bytes=<n> ms=<t>
+//   error id=<n> <message>
+//
+// Pending renders run highest priority first, in arrival order within a priority. Camera and
+// mesh edits are applied when their request runs and undone after its frame, unless it says
+// persist=1; a request naming an unknown mesh changes nothing. The image is written straight
+// into a POSIX shared memory object the client maps by name; the server keeps it until that
+// client sends release, disconnects or the server shuts down. Only the client an image was
+// rendered for may release it. A disconnecting client's queued renders are dropped, and renders
+// still queued at shutdown are answered with an error.
+class RenderServer {
+public:
+    RenderServer(Scene& scene, RayTracingStrategy& tracer) : scene(scene), tracer(tracer) {}
+
+    bool run(const std::string& socketPath) {
+#if RENDER_SERVER_SUPPORTED
+        return serve(socketPath);
+#else
+        std::cerr << "Render server needs a POSIX system (" << socketPath << ")" << std::endl;
+        return false;
+#endif
+    }
+
+private:
+    enum class PixelFormat {
+        RGBA8,      // gamma encoded, as shown in the window
+        RGB32F      // linear float
+    };
+
+    struct MeshEdit {
+        std::string key;
+        std::string mesh;
+        glm::vec3 value{ 0.0f };
+    };
+
+    struct Request {
+        std::string id;
+        int priority = 0;
+        std::uint64_t sequence = 0;
+        int client = -1;
+
+        unsigned width = 640;
+        unsigned height = 480;
+        int samples = 0;                 // 0 keeps the server's setting
+        int integrator = -1;             // -1 keeps the server's setting
+        PixelFormat format = PixelFormat::RGBA8;
+
+        bool hasCamera = false;
+        bool hasTarget = false;
+        bool hasFov = false;
+        glm::vec3 camera{ 0.0f };
+        glm::vec3 target{ 0.0f };
+        float fov = 45.0f;
+        std::vector<MeshEdit> edits;
+        bool persist = false;
+    };
+
+    // what a request's edits overwrote, put back after its frame
+    struct SavedState {
+        Camera camera;
+        struct MeshState {
+            Mesh* mesh;
+            glm::vec3 position, rotation, scale, color;
+        };
+        std::vector<MeshState> meshes;
+    };
+
+    struct ByPriority {
+        bool operator()(const Request& a, const Request& b) const {
+            if (a.priority != b.priority) return a.priority < b.priority;
+            return a.sequence > b.sequence;
+        }
+    };
+
+    static constexpr unsigned MAX_DIMENSION = 16384;
+    static constexpr unsigned BAND_HEIGHT = 32;
+
+    Scene& scene;
+    RayTracingStrategy& tracer;
+
+    std::priority_queue<Request, std::vector<Request>, ByPriority> queue;
+    std::uint64_t nextSequence = 0;
+    std::uint64_t nextImage = 0;
+    std::map<std::string, int> images;  // shm name -> socket of the client it belongs to
+    bool stopping = false;
+
+    static bool parseVec3(const std::string& text, glm::vec3& out) {
+        char c1 = 0, c2 = 0;
+        std::istringstream in(text);
+        return static_cast<bool>(in >> out.x >> c1 >> out.y >> c2 >> out.z) && c1 == ',' && c2 == ',';
+    }
+
+    static bool parseUnsigned(const std::string& text, unsigned& out) {
+        try {
+            size_t used = 0;
+            unsigned long v = std::stoul(text, &used);
+            if (used != text.size()) return false;
+            out = static_cast<unsigned>(v);
+            return true;
+        }
+        catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    // false with a message for the client when the line is malformed
+    static bool parseRender(std::istringstream& in, Request& r, std::string& error) {
+        std::string token;
+        while (in >> token) {
+            const size_t eq = token.find('=');
+            if (eq == std::string::npos) {
+                error = "expected key=value, got " + token;
+                return false;
+            }
+            const std::string key = token.substr(0, eq);
+            const std::string value = token.substr(eq + 1);
+            unsigned number = 0;
+
+            bool ok = true;
+            if (key == "id") r.id = value;
+            else if (key == "priority") { try { r.priority = std::stoi(value); } catch (const std::exception&) { ok = false; } }
+            else if (key == "width") ok = parseUnsigned(value, r.width);
+            else if (key == "height") ok = parseUnsigned(value, r.height);
+            else if (key == "samples") { ok = parseUnsigned(value, number) && number > 0; r.samples = static_cast<int>(number); }
+            else if (key == "integrator") {
+                if (value == "whitted") r.integrator = static_cast<int>(Integrator::Whitted);
+                else if (value == "pt") r.integrator = static_cast<int>(Integrator::PathTracing);
+                else ok = false;
+            }
+            else if (key == "format") {
+                if (value == "rgba8") r.format = PixelFormat::RGBA8;
+                else if (value == "rgb32f") r.format = PixelFormat::RGB32F;
+                else ok = false;
+            }
+            else if (key == "camera") ok = r.hasCamera = parseVec3(value, r.camera);
+            else if (key == "target") ok = r.hasTarget = parseVec3(value, r.target);
+            else if (key == "fov") { try { r.fov = std::stof(value); r.hasFov = true; } catch (const std::exception&) { ok = false; } }
+            else if (key == "persist") {
+                ok = value == "0" || value == "1";
+                r.persist = value == "1";
+            }
+            else if (key == "move" || key == "rotate" || key == "scale" || key == "color") {
+                const size_t colon = value.rfind(':');
+                MeshEdit edit;
+                edit.key = key;
+                ok = colon != std::string::npos && parseVec3(value.substr(colon + 1), edit.value);
+                if (ok) {
+                    edit.mesh = value.substr(0, colon);
+                    r.edits.push_back(edit);
+                }
+            }
+            else {
+                error = "unknown key " + key;
+                return false;
+            }
+
+            if (!ok) {
+                error = "bad value for " + key;
+                return false;
+            }
+        }
+
+        if (r.id.empty()) {
+            error = "render needs an id";
+            return false;
+        }
+        if (r.width == 0 || r.height == 0 || r.width > MAX_DIMENSION || r.height > MAX_DIMENSION) {
+            error = "resolution out of range";
+            return false;
+        }
+        return true;
+    }
+
+    // All mesh names are resolved before anything is touched, so a failing request leaves the
+    // scene as it was. saved receives the values the edits overwrite.
+    bool applyEdits(const Request& r, SavedState& saved, std::string& error) {
+        std::vector<Mesh*> targets;
+        for (const auto& edit : r.edits) {
+            Mesh* mesh = nullptr;
+            for (auto* m : scene.getAllMeshes()) {
+                if (m && m->name == edit.mesh) {
+                    mesh = m;
+                    break;
+                }
+            }
+            if (!mesh) {
+                error = "no mesh named " + edit.mesh;
+                return false;
+            }
+            targets.push_back(mesh);
+        }
+
+        auto* camera = scene.getCamera();
+        if (camera) {
+            saved.camera = *camera;
+            if (r.hasCamera) camera->position = r.camera;
+            if (r.hasTarget) camera->target = r.target;
+            if (r.hasFov) camera->fov = std::clamp(r.fov, 1.0f, 179.0f);
+        }
+
+        saved.meshes.clear();
+        for (size_t i = 0; i < r.edits.size(); ++i) {
+            const auto& edit = r.edits[i];
+            Mesh* mesh = targets[i];
+            saved.meshes.push_back({ mesh, mesh->position, mesh->rotation, mesh->scale, mesh->material.diffuseColor });
+
+            if (edit.key == "move") mesh->position = edit.value;
+            else if (edit.key == "rotate") mesh->rotation = glm::radians(edit.value);
+            else if (edit.key == "scale") mesh->scale = edit.value;
+            else if (edit.key == "color") mesh->material.diffuseColor = edit.value;
+        }
+        return true;
+    }
+
+    // in reverse, so a mesh edited twice gets the value from before the first edit
+    void restoreEdits(const SavedState& saved) {
+        if (auto* camera = scene.getCamera()) *camera = saved.camera;
+        for (auto it = saved.meshes.rbegin(); it != saved.meshes.rend(); ++it) {
+            it->mesh->position = it->position;
+            it->mesh->rotation = it->rotation;
+            it->mesh->scale = it->scale;
+            it->mesh->material.diffuseColor = it->color;
+        }
+    }
+
+#if RENDER_SERVER_SUPPORTED
+    struct Client {
+        int fd = -1;
+        std::string input;
+    };
+
+    std::map<int, Client> clients;
+
+    bool serve(const std::string& socketPath) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Socket path too long: " << socketPath << std::endl;
+            return false;
+        }
+        std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) {
+            std::cerr << "Cannot create socket: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        unlink(socketPath.c_str());
+        if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0) {
+            std::cerr << "Cannot listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+            close(listener);
+            return false;
+        }
+        std::cout << "Render server listening on " << socketPath << std::endl;
+
+        std::vector<pollfd> polled;
+        char buffer[4096];
+
+        while (!stopping) {
+            polled.clear();
+            polled.push_back(pollfd{ listener, POLLIN, 0 });
+            for (auto& entry : clients) polled.push_back(pollfd{ entry.first, POLLIN, 0 });
+
+            // block only when there is nothing queued to render
+            if (poll(polled.data(), static_cast<nfds_t>(polled.size()), queue.empty() ? -1 : 0) < 0 && errno != EINTR) break;
+
+            if (polled[0].revents & POLLIN) {
+                int fd = accept(listener, nullptr, nullptr);
+                if (fd >= 0) clients[fd].fd = fd;
+            }
+
+            for (size_t i = 1; i < polled.size(); ++i) {
+                if (!(polled[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+                const int fd = polled[i].fd;
+
+                ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+                if (n <= 0) {
+                    if (n < 0 && errno == EINTR) continue;
+                    dropClient(fd);
+                    continue;
+                }
+
+                Client& client = clients[fd];
+                client.input.append(buffer, static_cast<size_t>(n));
+                for (size_t eol = client.input.find('\n'); eol != std::string::npos; eol = client.input.find('\n')) {
+                    std::string line = client.input.substr(0, eol);
+                    client.input.erase(0, eol + 1);
+                    handleLine(fd, line);
+                }
+            }
+
+            if (!queue.empty() && !stopping) {
+                Request request = queue.top();
+                queue.pop();
+                if (clients.count(request.client)) renderRequest(request);
+            }
+        }
+
+        for (; !queue.empty(); queue.pop()) {
+            if (clients.count(queue.top().client)) reply(queue.top().client, "error id=" + queue.top().id + " shutting down");
+        }
+        for (auto& entry : clients) close(entry.first);
+        clients.clear();
+        close(listener);
+        unlink(socketPath.c_str());
+
+        for (const auto& entry : images) shm_unlink(entry.first.c_str());
+        images.clear();
+        std::cout << "Render server stopped" << std::endl;
+        return true;
+    }
+
+    // The socket number is handed to the next client accept() returns, so nothing the old
+    // client queued or owns may stay keyed by it
+    void dropClient(int fd) {
+        close(fd);
+        clients.erase(fd);
+
+        std::vector<Request> kept;
+        for (; !queue.empty(); queue.pop()) {
+            if (queue.top().client != fd) kept.push_back(queue.top());
+        }
+        for (auto& request : kept) queue.push(std::move(request));
+
+        for (auto it = images.begin(); it != images.end();) {
+            if (it->second != fd) {
+                ++it;
+                continue;
+            }
+            shm_unlink(it->first.c_str());
+            it = images.erase(it);
+        }
+    }
+
+    void reply(int fd, const std::string& line) {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+        const std::string text = line + "\n";
+        const char* p = text.data();
+        size_t left = text.size();
+        while (left > 0) {
+            ssize_t n = send(fd, p, left, flags);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            p += n;
+            left -= static_cast<size_t>(n);
+        }
+    }
+
+    void handleLine(int fd, const std::string& line) {
+        std::istringstream in(line);
+        std::string command;
+        if (!(in >> command)) return;
+
+        if (command == "render") {
+            Request request;
+            std::string error;
+            if (!parseRender(in, request, error)) {
+                reply(fd, "error id=" + (request.id.empty() ? std::string("?") : request.id) + " " + error);
+                return;
+            }
+            request.client = fd;
+            request.sequence = nextSequence++;
+            queue.push(std::move(request));
+        }
+        else if (command == "release") {
+            std::string token;
+            in >> token;
+            const std::string name = token.rfind("shm=", 0) == 0 ? token.substr(4) : token;
+            auto it = images.find(name);
+            if (it == images.end() || it->second != fd) {
+                reply(fd, "error id=? unknown shm " + name);
+                return;
+            }
+            shm_unlink(name.c_str());
+            images.erase(it);
+            reply(fd, "ok");
+        }
+        else if (command == "shutdown") {
+            stopping = true;
+            reply(fd, "ok");
+        }
+        else {
+            reply(fd, "error id=? unknown command " + command);
+        }
+    }
+
+    void renderRequest(const Request& r) {
+        std::string error;
+        SavedState edited;
+        if (!applyEdits(r, edited, error)) {
+            reply(r.client, "error id=" + r.id + " " + error);
+            return;
+        }
+        renderFrame(r);
+        if (!r.persist) restoreEdits(edited);
+    }
+
+    void renderFrame(const Request& r) {
+        const auto start = std::chrono::steady_clock::now();
+
+        const RayTracingSettings saved = tracer.settings;
+        if (r.integrator >= 0) tracer.settings.integrator = static_cast<Integrator>(r.integrator);
+        if (r.samples > 0) {
+            if (tracer.settings.integrator == Integrator::PathTracing) tracer.settings.targetSamples = r.samples;
+            else tracer.settings.antialiasingSamples = r.samples;
+        }
+
+        const size_t pixelBytes = r.format == PixelFormat::RGBA8 ? 4 : 3 * sizeof(float);
+        const size_t size = size_t(r.width) * r.height * pixelBytes;
+        const std::string name = "/rtserver-" + std::to_string(getpid()) + "-" + std::to_string(nextImage++);
+
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 || ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            if (fd >= 0) {
+                close(fd);
+                shm_unlink(name.c_str());
+            }
+            tracer.settings = saved;
+            reply(r.client, "error id=" + r.id + " cannot create shared memory: " + std::strerror(errno));
+            return;
+        }
+
+        void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            tracer.settings = saved;
+            reply(r.client, "error id=" + r.id + " cannot map shared memory");
+            return;
+        }
+
+        bool rendered = tracer.beginFrame(scene, r.width, r.height);
+        if (rendered) {
+            auto* pixels = static_cast<std::uint8_t*>(mapped);
+            std::vector<glm::vec3> colors;
+            for (unsigned y0 = 0; y0 < r.height; y0 += BAND_HEIGHT) {
+                const unsigned y1 = std::min(r.height, y0 + BAND_HEIGHT);
+                tracer.renderRows(scene, y0, y1, colors);
+
+                std::uint8_t* dst = pixels + size_t(y0) * r.width * pixelBytes;
+                if (r.format == PixelFormat::RGBA8) GammaEncoder::encodeRow(colors.data(), colors.size(), dst);
+                else std::memcpy(dst, colors.data(), colors.size() * sizeof(glm::vec3));
+            }
+            if (tracer.settings.hardwareCounters) tracer.getHardwareCounters().printReport();
+        }
+        munmap(mapped, size);
+        tracer.settings = saved;
+
+        if (!rendered) {
+            shm_unlink(name.c_str());
+            reply(r.client, "error id=" + r.id + " scene has no camera");
+            return;
+        }
+        images[name] = r.client;
+
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::ostringstream line;
+        line << "done id=" << r.id << " shm=" << name << " width=" << r.width << " height=" << r.height
+            << " format=" << (r.format == PixelFormat::RGBA8 ? "rgba8" : "rgb32f") << " bytes=" << size << " ms=" << ms;
+        reply(r.client, line.str());
+    }
+#endif
+};
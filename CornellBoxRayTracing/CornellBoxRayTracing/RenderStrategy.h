@@ -12,11 +12,31 @@
 #include <limits>
 #include <cmath>
 #include <array>
+#include <cstdint>
+#include <chrono>
+#include <type_traits>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
 
 #include "Scene.h"
 #include "Mesh.h"
 #include "Camera.h"
+#include "ShadowMap.h"
+#include "LightTree.h"
+#include "AreaLight.h"
+#include "Parallel.h"
+#include "Random.h"
+#include "Sampler.h"
+#include "Wavefront.h"
+#include "FrameBuffer.h"
+#include "Checkpoint.h"
+#include "CostHeatmap.h"
+#include "PerfStats.h"
+#include "Trace.h"
+#include "HardwareCounters.h"
 #include <iostream>
+#include <string>
 
 class RenderStrategy {
 public:
@@ -46,7 +66,7 @@ private:
         auto model = mesh.getTransformMatrix();
         auto mvp = projection * view * model;
 
-        for (const auto& face : mesh.faces) {
+        for (const auto& face : mesh.geometry()) {
             for (size_t i = 0; i < face.vertices.size(); ++i) {
                 size_t next = (i + 1) % face.vertices.size();
 
@@ -80,56 +100,317 @@ private:
 };
 
 
+enum class Integrator {
+    Whitted,
+    PathTracing
+};
+
+enum class ShadowMode {
+    ExactRays,
+    ShadowMap
+};
+
+struct RayTracingSettings {
+    Integrator integrator = Integrator::Whitted;
+    SamplerType sampler = SamplerType::OwenSobolBlueNoise;
+    int antialiasingSamples = 1;
+    int maxDepth = 6;
+
+    // Whitted frames get this many milliseconds; the tracer times a few probe samples and
+    // lowers antialiasing, ray depth and then resolution until the frame fits. 0 = off
+    float deadlineMs = 0.0f;
+
+    // count the work done per pixel and show it as a false-colour heatmap instead of the image
+    bool costHeatmap = false;
+    CostMetric costMetric = CostMetric::TriangleTests;
+
+    // instructions, cycles, cache and branch misses per phase and thread, printed after each
+    // frame (Linux perf_event_open)
+    bool hardwareCounters = false;
+
+    bool wavefront = false;
+    int wavefrontTileSize = 128;
+    int samplesPerFrame = 1;
+    int targetSamples = 1024;
+    int pathMaxDepth = 8;
+    int rouletteDepth = 3;
+
+    // progressive accumulation is saved every checkpointInterval seconds, less often when
+    // writing would take more than checkpointMaxOverhead of the render time
+    bool checkpoints = false;
+    std::string checkpointPath = "render.ckpt";
+    float checkpointInterval = 30.0f;
+    float checkpointMaxOverhead = 0.02f;
+
+    ShadowMode shadowMode = ShadowMode::ExactRays;
+    int shadowMapResolution = 512;
+    int shadowMapFilterRadius = 1;
+
+    bool useLightTree = true;
+    int maxLightsPerHit = 16;
+    float lightCutoffRadius = 0.0f;
+
+    bool areaLights = true;
+    int areaLightSamples = 16;
+    int areaLightProbes = 4;
+    int maxAreaLightsPerHit = 4;    // with more emitters, this many are picked by power per hit
+};
+
+// The quality a deadline render settled on and how long the frame really took
+struct DeadlineReport {
+    float budgetMs = 0.0f;
+    float resolutionScale = 1.0f;
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned samples = 1;
+    int maxDepth = 1;
+    double probeMs = 0.0;
+    double predictedMs = 0.0;
+    double actualMs = 0.0;
+
+    bool met() const { return actualMs <= budgetMs; }
+};
+
 class RayTracingStrategy {
 public:
-    void renderToImage(sf::Image& image, Scene& scene) {
-        auto* camera = scene.getCamera();
-        if (!camera) return;
+    RayTracingSettings settings;
 
-        const unsigned width = image.getSize().x;
-        const unsigned height = image.getSize().y;
-        if (width == 0 || height == 0) return;
+    // Renders into frame's RGBA bytes at the frame's size
+    void render(FrameBuffer& frame, const Scene& scene) {
+        const auto start = std::chrono::steady_clock::now();
+        if (!beginFrame(scene, frame.width, frame.height)) return;
 
-        std::vector<RTMesh> meshes;
-        std::vector<RTSphere> spheres;
-        buildRTObjects(scene, meshes, spheres);
+        if (settings.costHeatmap) {
+            renderCostHeatmap(frame, scene);
+            return;
+        }
 
-        auto lights = scene.getLights();
+        const unsigned width = frame.width;
+        const unsigned height = frame.height;
 
-        const float fov = glm::radians(camera->fov);
-        const float aspect = float(width) / float(height);
-        const float scale = std::tan(fov * 0.5f);
-        const glm::mat4 invView = glm::inverse(camera->getViewMatrix());
+        if (settings.integrator != Integrator::PathTracing) {
+            if (settings.deadlineMs > 0.0f) {
+                renderToDeadline(frame, scene, start);
+                if (settings.hardwareCounters) hardwareCounters.printReport();
+                return;
+            }
 
-        for (unsigned y = 0; y < height; ++y) {
-            for (unsigned x = 0; x < width; ++x) {
-                float ndcX = (2.0f * (x + 0.5f) / float(width) - 1.0f);
-                float ndcY = (1.0f - 2.0f * (y + 0.5f) / float(height));
+            const unsigned aaSamples = antialiasingSamples();
 
-                ndcX *= aspect * scale;
-                ndcY *= scale;
+            traceRows(scene, 0, height, 0, aaSamples, [&](unsigned y, unsigned x0, unsigned count, const glm::vec3* sums) {
+                thread_local std::vector<glm::vec3> line;
+                line.resize(count);
+                for (unsigned i = 0; i < count; ++i) line[i] = sums[i] / float(aaSamples);
+                GammaEncoder::encodeRow(line.data(), count, frame.row(y) + size_t(x0) * 4);
+                });
 
-                glm::vec3 rayDirCam = glm::normalize(glm::vec3(ndcX, ndcY, -1.0f));
-                glm::vec3 rayDirWorld = glm::normalize(glm::vec3(invView * glm::vec4(rayDirCam, 0.0f)));
-                glm::vec3 rayOrigin = camera->position;
+            if (settings.wavefront) printWavefrontStats();
+            if (settings.hardwareCounters) hardwareCounters.printReport();
+            return;
+        }
 
-                glm::vec3 color = traceRay(rayOrigin, rayDirWorld, meshes, spheres, lights, scene, 0, 1.0f);
-                image.setPixel({ x, y }, toSFMLColor(color));
-            }
+        std::uint64_t key = accumulationKey(scene, frameContext.meshes, frameContext.spheres, width, height);
+        if (key != accumulationSignature || accumulation.size() != size_t(width) * height) {
+            accumulation.assign(size_t(width) * height, glm::vec3(0.0f));
+            accumulatedSamples = 0;
+            accumulationSignature = key;
+
+            checkpointStats = CheckpointStats{};
+            lastCheckpoint = std::chrono::steady_clock::now();
+            if (settings.checkpoints) resumeFromCheckpoint(width, height, key);
         }
+
+        const auto frameStart = std::chrono::steady_clock::now();
+
+        const unsigned firstSample = accumulatedSamples;
+        const unsigned samples = static_cast<unsigned>(std::max(1, settings.samplesPerFrame));
+
+        traceRows(scene, 0, height, firstSample, samples, [&](unsigned y, unsigned x0, unsigned count, const glm::vec3* sums) {
+            thread_local std::vector<glm::vec3> line;
+            line.resize(count);
+
+            for (unsigned i = 0; i < count; ++i) {
+                const size_t pixel = size_t(y) * width + x0 + i;
+                accumulation[pixel] += sums[i];
+                line[i] = accumulation[pixel] / float(firstSample + samples);
+            }
+            GammaEncoder::encodeRow(line.data(), count, frame.row(y) + size_t(x0) * 4);
+            });
+
+        accumulatedSamples = firstSample + samples;
+        checkpointStats.renderSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count();
+
+        if (settings.checkpoints) maybeWriteCheckpoint(width, height);
+        if (settings.hardwareCounters) hardwareCounters.printReport();
+    }
+
+    // Prepares the scene and camera for a width x height image. renderRows() can then trace
+    // any band of it, so images far larger than the window are rendered piece by piece.
+    bool beginFrame(const Scene& scene, unsigned width, unsigned height) {
+        auto* camera = scene.getCamera();
+        if (!camera || width == 0 || height == 0) return false;
+
+        prepareScene(scene);
+        frameContext.view = makeView(*camera, width, height);
+        return true;
+    }
+
+    // Linear colour of rows [y0, y1) of the frame set up by beginFrame(), averaged over the
+    // antialiasing samples (Whitted) or targetSamples (path tracing)
+    void renderRows(const Scene& scene, unsigned y0, unsigned y1, std::vector<glm::vec3>& out) {
+        const unsigned width = frameContext.view.width;
+        y1 = std::min(y1, frameContext.view.height);
+        out.resize(size_t(width) * (y1 > y0 ? y1 - y0 : 0));
+        if (y1 <= y0) return;
+
+        const unsigned samples = settings.integrator == Integrator::PathTracing
+            ? static_cast<unsigned>(std::max(1, settings.targetSamples))
+            : antialiasingSamples();
+
+        traceRows(scene, y0, y1, 0, samples, [&](unsigned y, unsigned x0, unsigned count, const glm::vec3* sums) {
+            glm::vec3* dst = out.data() + size_t(y - y0) * width + x0;
+            for (unsigned i = 0; i < count; ++i) dst[i] = sums[i] / float(samples);
+            });
+    }
+
+    // Renders the scene from every camera with one scene build. Tiles of all views share one
+    // pool in view order with no barrier in between, so cores move on to the next view while
+    // the last tiles of the previous one finish. onViewDone(index, colors) receives a view's
+    // linear colours, averaged like renderRows(), on the worker thread that completes it.
+    template <typename ViewDoneFn>
+    bool renderViews(const Scene& scene, const std::vector<Camera>& cameras, unsigned width, unsigned height, ViewDoneFn&& onViewDone) {
+        if (cameras.empty() || width == 0 || height == 0) return false;
+
+        prepareScene(scene);
+
+        const unsigned samples = settings.integrator == Integrator::PathTracing
+            ? static_cast<unsigned>(std::max(1, settings.targetSamples))
+            : antialiasingSamples();
+
+        const unsigned tilesX = (width + VIEW_TILE_SIZE - 1) / VIEW_TILE_SIZE;
+        const unsigned tilesY = (height + VIEW_TILE_SIZE - 1) / VIEW_TILE_SIZE;
+        const size_t tilesPerView = size_t(tilesX) * tilesY;
+
+        std::vector<ViewContext> views;
+        views.reserve(cameras.size());
+        for (const auto& camera : cameras) views.push_back(makeView(camera, width, height));
+
+        // a view's image only exists between its first and its last tile
+        std::vector<std::vector<glm::vec3>> images(cameras.size());
+        std::vector<std::once_flag> allocated(cameras.size());
+        std::unique_ptr<std::atomic<size_t>[]> tilesLeft(new std::atomic<size_t>[cameras.size()]);
+        for (size_t v = 0; v < cameras.size(); ++v) tilesLeft[v] = tilesPerView;
+
+        Parallel::forEach(tilesPerView * cameras.size(), [&](size_t index) {
+            TRACE_SCOPE("view tile");
+            const size_t v = index / tilesPerView;
+            const size_t tile = index % tilesPerView;
+            const unsigned x0 = static_cast<unsigned>(tile % tilesX) * VIEW_TILE_SIZE;
+            const unsigned y0 = static_cast<unsigned>(tile / tilesX) * VIEW_TILE_SIZE;
+            const unsigned x1 = std::min(width, x0 + VIEW_TILE_SIZE);
+            const unsigned y1 = std::min(height, y0 + VIEW_TILE_SIZE);
+
+            std::call_once(allocated[v], [&]() { images[v].resize(size_t(width) * height); });
+            glm::vec3* image = images[v].data();
+
+            {
+                HardwareCounterScope counters(hardwareCounters, HwPhase::TraceRows);
+                for (unsigned y = y0; y < y1; ++y) {
+                    for (unsigned x = x0; x < x1; ++x) {
+                        image[size_t(y) * width + x] = tracePixel(scene, views[v], x, y, 0, samples) / float(samples);
+                    }
+                }
+            }
+
+            if (tilesLeft[v].fetch_sub(1) == 1) {
+                onViewDone(v, static_cast<const std::vector<glm::vec3>&>(images[v]));
+                std::vector<glm::vec3>().swap(images[v]);
+            }
+            });
+
+        if (settings.hardwareCounters) hardwareCounters.printReport();
+        return true;
+    }
+
+    void resetAccumulation() {
+        accumulation.clear();
+        accumulatedSamples = 0;
+    }
+
+    unsigned getAccumulatedSamples() const { return accumulatedSamples; }
+
+    const WavefrontStats& getWavefrontStats() const { return wavefrontStats; }
+    const CheckpointStats& getCheckpointStats() const { return checkpointStats; }
+    const DeadlineReport& getDeadlineReport() const { return deadlineReport; }
+    const std::vector<PixelCost>& getPixelCosts() const { return pixelCosts; }
+    const HardwareCounters& getHardwareCounters() const { return hardwareCounters; }
+
+    // time the last beginFrame() spent building objects, lights, light tree and shadow maps
+    double getSceneBuildMs() const { return sceneBuildMs; }
+
+    // bytes held by the tracer's per-frame structures and caches
+    size_t memoryBytes() const {
+        size_t bytes = frameContext.meshes.capacity() * sizeof(RTMesh) + frameContext.spheres.capacity() * sizeof(RTSphere);
+        bytes += lights.capacity() * sizeof(Light) + lightTree.memoryBytes();
+        for (const auto& area : areaLights) bytes += sizeof(AreaLight) + area.memoryBytes();
+        bytes += (areaLightCdf.capacity() + areaLightPdf.capacity()) * sizeof(float);
+        for (const auto& map : shadowMaps) bytes += sizeof(CubeShadowMap) + map.memoryBytes();
+        for (const auto& entry : compiled) bytes += sizeof(CompiledMesh) + entry.second.area.memoryBytes();
+        bytes += sceneMeshes.capacity() * sizeof(Mesh*);
+        bytes += accumulation.capacity() * sizeof(glm::vec3);
+        bytes += pixelCosts.capacity() * sizeof(PixelCost);
+        bytes += deadlineFrame.pixels.capacity();
+        return bytes;
+    }
+
+    bool needsMoreSamples() const {
+        return settings.integrator == Integrator::PathTracing && !settings.costHeatmap &&
+            accumulatedSamples < static_cast<unsigned>(std::max(1, settings.targetSamples));
     }
 
 private:
-    static constexpr int   MAX_DEPTH = 6;
+    // times the private kernels in isolation
+    friend class Microbenchmarks;
+
     static constexpr float EPS = 1e-3f;
+    static constexpr unsigned VIEW_TILE_SIZE = 32;
+
+    // deadline renders: primary samples timed per probe, share of the budget planned for
+    // and the resolution steps tried after antialiasing and depth are exhausted
+    static constexpr unsigned DEADLINE_PROBE_SAMPLES = 1024;
+    static constexpr double DEADLINE_MARGIN = 0.85;
+    static constexpr float DEADLINE_SCALES[] = { 1.0f, 0.75f, 0.5f, 0.35f, 0.25f };
+
+    // sampler dimensions: the pixel jitter, then a fixed block per bounce so that a given
+    // decision always reads the same dimension whichever branch the path took before
+    static constexpr std::uint32_t DIM_PIXEL = 0;
+    static constexpr std::uint32_t DIM_FIRST_BOUNCE = 2;
+    static constexpr std::uint32_t DIM_GLASS = 0;
+    static constexpr std::uint32_t DIM_FRESNEL = 1;
+    static constexpr std::uint32_t DIM_MIRROR = 2;
+    static constexpr std::uint32_t DIM_LIGHT_SELECT = 3;
+    static constexpr std::uint32_t DIM_LIGHT_POINT = 4;
+    static constexpr std::uint32_t DIM_BSDF = 6;
+    static constexpr std::uint32_t DIM_ROULETTE = 8;
+    static constexpr std::uint32_t DIMS_PER_BOUNCE = 9;
+
+    // material feature sets, fixed when the scene is built; each combination gets
+    // its own Whitted shading kernel
+    static constexpr unsigned FEATURE_SPECULAR = 1u;
+    static constexpr unsigned FEATURE_MIRROR = 2u;
+    static constexpr unsigned FEATURE_GLASS = 4u;
 
     struct RTMesh {
-        Mesh* mesh = nullptr;
+        const Mesh* mesh = nullptr;
         glm::mat4 model{ 1.0f };
         glm::mat4 invModel{ 1.0f };
         glm::mat3 normalMat{ 1.0f };
         bool isLight = false;
         bool isHidden = false; 
+        int areaLight = -1;
+        unsigned features = 0;
+        std::uint32_t triangleCount = 0;
+        std::uint64_t geometryHash = 0;     // of the vertex positions, for the signatures
     };
 
     struct RTSphere {
@@ -138,6 +419,7 @@ private:
         Material  material{};
         bool isLight = false;
         bool isHidden = false;
+        unsigned features = 0;
     };
 
     struct HitInfo {
@@ -148,9 +430,85 @@ private:
         bool frontFace = true;
         bool hit = false;
         bool hitLight = false;
+        int areaLight = -1;
+        unsigned features = 0;
         Material material{};
+        glm::vec3 eye{ 0.0f };      // camera of the view, for specular highlights
+    };
+
+    // everything a primary ray needs from the camera and image size
+    struct ViewContext {
+        glm::vec3 rayOrigin{ 0.0f };
+        glm::mat4 invView{ 1.0f };
+        float aspect = 1.0f;
+        float scale = 1.0f;
+        unsigned width = 0;
+        unsigned height = 0;
+
+        glm::vec3 primaryDir(float px, float py) const {
+            float ndcX = (2.0f * px / float(width) - 1.0f);
+            float ndcY = (1.0f - 2.0f * py / float(height));
+
+            ndcX *= aspect * scale;
+            ndcY *= scale;
+
+            glm::vec3 rayDirCam = glm::normalize(glm::vec3(ndcX, ndcY, -1.0f));
+            return glm::normalize(glm::vec3(invView * glm::vec4(rayDirCam, 0.0f)));
+        }
+    };
+
+    struct FrameContext {
+        std::vector<RTMesh> meshes;
+        std::vector<RTSphere> spheres;
+        ViewContext view;
+    };
+
+    FrameContext frameContext;
+    int whittedMaxDepth = 6;
+    WavefrontStats wavefrontStats;
+    DeadlineReport deadlineReport;
+    FrameBuffer deadlineFrame;
+    std::vector<PixelCost> pixelCosts;
+    double sceneBuildMs = 0.0;
+    CheckpointStats checkpointStats;
+    HardwareCounters hardwareCounters;
+    std::chrono::steady_clock::time_point lastCheckpoint = std::chrono::steady_clock::now();
+
+    std::vector<Light> lights;
+    std::vector<AreaLight> areaLights;
+    std::vector<float> areaLightCdf;
+    std::vector<float> areaLightPdf;
+    LightTree lightTree;
+    std::uint64_t lightTreeSignature = 0;
+
+    std::vector<CubeShadowMap> shadowMaps;
+    std::uint64_t shadowMapSignature = 0;
+
+    std::vector<glm::vec3> accumulation;
+    unsigned accumulatedSamples = 0;
+    std::uint64_t accumulationSignature = 0;
+
+    // What buildRTObjects() derived from a mesh. Transform and geometry parts are only worked
+    // out again when the mesh's position, rotation, scale or geometry revision changed, and the
+    // area light only then or when its emission changed, so frames of a static scene skip them.
+    struct CompiledMesh {
+        RTMesh rt;
+        std::string name;
+        bool isSphere = false;
+        bool namedLight = false;
+        glm::vec3 position{ 0.0f };
+        glm::vec3 rotation{ 0.0f };
+        glm::vec3 scale{ 1.0f };
+        std::uint64_t geometryRevision = 0;
+        AreaLight area;
+        bool areaBuilt = false;
+        std::uint64_t frame = 0;
     };
 
+    std::unordered_map<const Mesh*, CompiledMesh> compiled;
+    std::vector<Mesh*> sceneMeshes;
+    std::uint64_t compileFrame = 0;
+
 private:
     static glm::vec3 reflectVec(const glm::vec3& v, const glm::vec3& nUnit) {
         return v - 2.0f * glm::dot(v, nUnit) * nUnit;
@@ -174,19 +532,21 @@ private:
         return true;
     }
 
-    void buildRTObjects(Scene& scene, std::vector<RTMesh>& outMeshes, std::vector<RTSphere>& outSpheres) {
-        auto meshes = scene.getAllMeshes();
+    void buildRTObjects(const Scene& scene, std::vector<RTMesh>& outMeshes, std::vector<RTSphere>& outSpheres) {
+        TRACE_SCOPE("buildRTObjects");
+        scene.collectMeshes(sceneMeshes);
+        ++compileFrame;
 
         outMeshes.clear();
         outSpheres.clear();
-        outMeshes.reserve(meshes.size());
+        outMeshes.reserve(sceneMeshes.size());
 
-        for (auto* m : meshes) {
+        for (auto* m : sceneMeshes) {
             if (!m) continue;
 
-            const bool isSphere = (m->name.find("Sphere") != std::string::npos);
+            const CompiledMesh& c = compileMesh(*m);
 
-            if (isSphere) {
+            if (c.isSphere) {
                 RTSphere s;
                 s.isHidden = false;
                 s.isLight = false;
@@ -194,46 +554,169 @@ private:
                 s.center = m->position;
                 float r = std::max({ std::abs(m->scale.x), std::abs(m->scale.y), std::abs(m->scale.z) });
                 s.radius = std::max(1e-4f, r);
+                s.features = materialFeatures(s.material);
                 outSpheres.push_back(s);
                 continue;
             }
 
-            RTMesh r;
-            r.mesh = m;
-            r.isHidden = (m->name == "Wall_FrontWall");
-            r.isLight = (m->name.find("LightCapsule") != std::string::npos || m->name.find("Light_") != std::string::npos);
-            r.model = m->getTransformMatrix();
-            r.invModel = glm::inverse(r.model);
-            r.normalMat = glm::transpose(glm::inverse(glm::mat3(r.model)));
+            RTMesh r = c.rt;
+            r.isLight = c.namedLight || m->material.isEmissive;
+            r.features = materialFeatures(m->material);
             outMeshes.push_back(r);
         }
+
+        // meshes that left the scene
+        for (auto it = compiled.begin(); it != compiled.end(); ) {
+            if (it->second.frame != compileFrame) it = compiled.erase(it);
+            else ++it;
+        }
+    }
+
+    // A mesh at the address of a deleted one has another geometry revision, so it is never
+    // taken for the old one
+    const CompiledMesh& compileMesh(const Mesh& m) {
+        CompiledMesh& c = compiled[&m];
+        const bool fresh = c.rt.mesh == nullptr;
+        c.rt.mesh = &m;
+        c.frame = compileFrame;
+
+        if (fresh || c.name != m.name) {
+            c.name = m.name;
+            c.isSphere = (m.name.find("Sphere") != std::string::npos);
+            c.namedLight = (m.name.find("LightCapsule") != std::string::npos || m.name.find("Light_") != std::string::npos);
+            c.rt.isHidden = (m.name == "Wall_FrontWall");
+        }
+        if (c.isSphere) return c;
+
+        if (fresh || c.position != m.position || c.rotation != m.rotation || c.scale != m.scale) {
+            c.position = m.position;
+            c.rotation = m.rotation;
+            c.scale = m.scale;
+            c.rt.model = m.getTransformMatrix();
+            c.rt.invModel = glm::inverse(c.rt.model);
+            c.rt.normalMat = glm::transpose(glm::inverse(glm::mat3(c.rt.model)));
+            c.areaBuilt = false;
+        }
+
+        if (fresh || c.geometryRevision != m.geometryRevision) {
+            c.geometryRevision = m.geometryRevision;
+            c.rt.triangleCount = 0;
+            c.rt.geometryHash = HASH_SEED;
+            for (const auto& face : m.geometry()) {
+                if (face.vertices.size() >= 3) c.rt.triangleCount += static_cast<std::uint32_t>(face.vertices.size() - 2);
+                for (const auto& v : face.vertices) hashBytes(c.rt.geometryHash, &v.position, sizeof(v.position));
+            }
+            c.areaBuilt = false;
+        }
+        return c;
+    }
+
+    // mirror wins over glass, as in traceRay()
+    static unsigned materialFeatures(const Material& m) {
+        unsigned features = 0;
+        if (m.shininess > 1.0f) features |= FEATURE_SPECULAR;
+
+        if (m.isMirror && m.reflectivity > 0.0f) features |= FEATURE_MIRROR;
+        else if (m.isTransparent && m.transparency > 0.0f) features |= FEATURE_GLASS;
+        return features;
+    }
+
+    // emissive meshes replace the point light of their node when area lights are on;
+    // the path tracer always treats them as lights
+    void gatherLights(const Scene& scene, std::vector<RTMesh>& meshes) {
+        const bool useAreaLights = settings.areaLights || settings.integrator == Integrator::PathTracing;
+
+        lights.clear();
+        for (auto* node : scene.lights) {
+            if (!node || !node->light) continue;
+            if (useAreaLights && node->mesh && node->mesh->material.isEmissive) continue;
+            lights.push_back(*node->light);
+        }
+
+        areaLights.clear();
+        areaLightCdf.clear();
+        areaLightPdf.clear();
+        if (!useAreaLights) return;
+
+        float totalPower = 0.0f;
+        for (auto& m : meshes) {
+            if (!m.mesh->material.isEmissive || m.mesh->material.emissionStrength <= 0.0f) continue;
+
+            // built with the mesh's compiled transform, so it is kept until that or the emission changes
+            CompiledMesh& c = compiled[m.mesh];
+            const glm::vec3 radiance = m.mesh->material.emissionColor * m.mesh->material.emissionStrength;
+            if (!c.areaBuilt || c.area.radiance != radiance) {
+                c.area.build(*m.mesh, m.model);
+                c.areaBuilt = true;
+            }
+            const AreaLight& area = c.area;
+            if (area.triangles.empty()) continue;
+
+            float power = std::max(1e-6f, (area.radiance.r + area.radiance.g + area.radiance.b) * area.totalArea);
+            totalPower += power;
+            areaLightPdf.push_back(power);
+            areaLightCdf.push_back(totalPower);
+
+            m.areaLight = static_cast<int>(areaLights.size());
+            areaLights.push_back(area);
+        }
+
+        for (size_t i = 0; i < areaLights.size(); ++i) {
+            areaLightPdf[i] /= totalPower;
+            areaLightCdf[i] /= totalPower;
+        }
     }
 
-    glm::vec3 traceRay(const glm::vec3& origin, const glm::vec3& dirUnit, const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres, const std::vector<Light>& lights, const Scene& scene, int depth, float environmentIor)
+    glm::vec3 traceRay(const glm::vec3& origin, const glm::vec3& dirUnit, const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres, const std::vector<Light>& lights, const Scene& scene, const Sampler& sampler, int depth, float environmentIor, const glm::vec3& eye)
     {
-        if (depth >= MAX_DEPTH) return scene.backgroundColor;
+        if (depth >= whittedMaxDepth) return scene.backgroundColor;
 
         HitInfo hit;
         if (!intersectScene(origin, dirUnit, meshes, spheres, hit, (depth == 0)))
             return scene.backgroundColor;
+        hit.eye = eye;
+
+        if (PixelCost* cost = activeCost()) cost->depth = std::max(cost->depth, static_cast<std::uint32_t>(depth + 1));
 
         if (hit.hitLight) return glm::vec3(1.0f);
 
+        switch (hit.features) {
+        case FEATURE_SPECULAR:
+            return shadeHit<FEATURE_SPECULAR>(hit, dirUnit, meshes, spheres, lights, scene, sampler, depth, environmentIor);
+        case FEATURE_MIRROR:
+            return shadeHit<FEATURE_MIRROR>(hit, dirUnit, meshes, spheres, lights, scene, sampler, depth, environmentIor);
+        case FEATURE_MIRROR | FEATURE_SPECULAR:
+            return shadeHit<FEATURE_MIRROR | FEATURE_SPECULAR>(hit, dirUnit, meshes, spheres, lights, scene, sampler, depth, environmentIor);
+        case FEATURE_GLASS:
+            return shadeHit<FEATURE_GLASS>(hit, dirUnit, meshes, spheres, lights, scene, sampler, depth, environmentIor);
+        case FEATURE_GLASS | FEATURE_SPECULAR:
+            return shadeHit<FEATURE_GLASS | FEATURE_SPECULAR>(hit, dirUnit, meshes, spheres, lights, scene, sampler, depth, environmentIor);
+        default:
+            return shadeHit<0>(hit, dirUnit, meshes, spheres, lights, scene, sampler, depth, environmentIor);
+        }
+    }
+
+    // Whitted shading kernel for one material feature set. Branches for features the
+    // material lacks are compiled out, so the plain Lambert kernel has no pow() and
+    // spawns no secondary rays.
+    template <unsigned Features>
+    glm::vec3 shadeHit(const HitInfo& hit, const glm::vec3& dirUnit, const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres, const std::vector<Light>& lights, const Scene& scene, const Sampler& sampler, int depth, float environmentIor)
+    {
         const Material& mat = hit.material;
 
-        glm::vec3 direct = shadeDirect(hit, lights, scene, meshes, spheres);
+        glm::vec3 direct = shadeDirect<(Features & FEATURE_SPECULAR) != 0>(hit, lights, scene, meshes, spheres, sampler, depth);
 
-        if (mat.isMirror && mat.reflectivity > 0.0f) {
+        if constexpr ((Features & FEATURE_MIRROR) != 0) {
             float k = std::clamp(mat.reflectivity, 0.0f, 1.0f);
 
             glm::vec3 R = glm::normalize(reflectVec(dirUnit, hit.nGeom));
             glm::vec3 o = hit.p + hit.nGeom * (glm::dot(R, hit.nGeom) > 0.0f ? EPS : -EPS);
 
-            glm::vec3 refl = traceRay(o, R, meshes, spheres, lights, scene, depth + 1, environmentIor);
+            countSecondaryRay(RayType::Reflection, depth);
+            glm::vec3 refl = traceRay(o, R, meshes, spheres, lights, scene, sampler, depth + 1, environmentIor, hit.eye);
             return glm::clamp(direct * (1.0f - k) + refl * k, 0.0f, 1.0f);
         }
-
-        if (mat.isTransparent && mat.transparency > 0.0f) {
+        else if constexpr ((Features & FEATURE_GLASS) != 0) {
             float tr = std::clamp(mat.transparency, 0.0f, 1.0f);
 
             float ior = (mat.refractiveIndex > 1e-4f) ? mat.refractiveIndex : 1.5f;
@@ -247,13 +730,11 @@ private:
             float kr = schlick(cosTheta, n1, n2);
             kr = std::clamp(kr, 0.0f, 1.0f);
 
-            // Если материал одновременно стекло+зеркало — усилим отражение
-            if (mat.isMirror) kr = std::max(kr, std::clamp(mat.reflectivity, 0.0f, 1.0f));
-
             // reflect
             glm::vec3 R = glm::normalize(reflectVec(dirUnit, N));
             glm::vec3 oR = hit.p + N * (glm::dot(R, N) > 0.0f ? EPS : -EPS);
-            glm::vec3 refl = traceRay(oR, R, meshes, spheres, lights, scene, depth + 1, environmentIor);
+            countSecondaryRay(RayType::Reflection, depth);
+            glm::vec3 refl = traceRay(oR, R, meshes, spheres, lights, scene, sampler, depth + 1, environmentIor, hit.eye);
 
             // refract
             glm::vec3 refr(0.0f);
@@ -265,7 +746,8 @@ private:
                 glm::vec3 oT = hit.p + N * (glm::dot(T, N) > 0.0f ? EPS : -EPS);
 
                 float nextEnvIor = hit.frontFace ? ior : 1.0f;
-                refr = traceRay(oT, T, meshes, spheres, lights, scene, depth + 1, nextEnvIor);
+                countSecondaryRay(RayType::Refraction, depth);
+                refr = traceRay(oT, T, meshes, spheres, lights, scene, sampler, depth + 1, nextEnvIor, hit.eye);
 
                 refr *= mat.diffuseColor;
             }
@@ -278,8 +760,817 @@ private:
             glm::vec3 out = direct * (1.0f - tr) + glass * tr;
             return glm::clamp(out, 0.0f, 1.0f);
         }
+        else {
+            return glm::clamp(direct, 0.0f, 1.0f);
+        }
+    }
+
+    // traceRay() stops at whittedMaxDepth without tracing, so those calls are not rays
+    void countSecondaryRay(RayType type, int depth) const {
+        if (depth + 1 < whittedMaxDepth) RayCounters::add(type);
+    }
+
+    void resumeFromCheckpoint(unsigned width, unsigned height, std::uint64_t key) {
+        AccumulationCheckpoint::Header header;
+        std::vector<glm::vec3> sums;
+        if (!AccumulationCheckpoint::read(settings.checkpointPath, header, sums)) return;
+
+        if (header.sceneKey != key || header.width != width || header.height != height) {
+            std::cout << "Checkpoint " << settings.checkpointPath << " belongs to another scene or size, starting over" << std::endl;
+            return;
+        }
+
+        accumulation = std::move(sums);
+        accumulatedSamples = header.samples;
+        checkpointStats.resumedSamples = header.samples;
+        std::cout << "Resumed from checkpoint at " << header.samples << " samples per pixel" << std::endl;
+    }
+
+    void maybeWriteCheckpoint(unsigned width, unsigned height) {
+        const auto now = std::chrono::steady_clock::now();
+        const double sinceLast = std::chrono::duration<double>(now - lastCheckpoint).count();
+        const bool finished = !needsMoreSamples();
+
+        // the last write predicts the next one; wait until it would stay within the budget
+        const double budget = std::max(1e-3, double(settings.checkpointMaxOverhead));
+        const bool due = sinceLast >= settings.checkpointInterval && checkpointStats.lastWriteSeconds <= budget * sinceLast;
+        if (!due && !finished) return;
+
+        AccumulationCheckpoint::Header header;
+        header.width = width;
+        header.height = height;
+        header.samples = accumulatedSamples;
+        header.sceneKey = accumulationSignature;
+
+        const bool ok = AccumulationCheckpoint::write(settings.checkpointPath, header, accumulation);
+        const auto done = std::chrono::steady_clock::now();
+        const double seconds = std::chrono::duration<double>(done - now).count();
+
+        checkpointStats.lastWriteSeconds = seconds;
+        checkpointStats.writeSeconds += seconds;
+        checkpointStats.renderSeconds += seconds;
+        lastCheckpoint = done;
+        if (!ok) return;
+
+        ++checkpointStats.writes;
+        std::cout << "Checkpoint: " << accumulatedSamples << " spp written in " << seconds * 1000.0
+            << " ms, overhead " << checkpointStats.overhead() * 100.0 << "%" << std::endl;
+    }
+
+    // camera-independent part of beginFrame(), shared by every view of a batch
+    void prepareScene(const Scene& scene) {
+        TRACE_SCOPE("prepareScene");
+        // this tracer's totals only, so another tracer's frames leave a running report alone
+        hardwareCounters.setEnabled(settings.hardwareCounters);
+        hardwareCounters.reset();
+        HardwareCounterScope counters(hardwareCounters, HwPhase::SceneBuild);
+
+        const auto start = std::chrono::steady_clock::now();
+        buildRTObjects(scene, frameContext.meshes, frameContext.spheres);
+
+        gatherLights(scene, frameContext.meshes);
+        updateLightTree();
+
+        if (settings.integrator != Integrator::PathTracing && settings.shadowMode == ShadowMode::ShadowMap) {
+            updateShadowMaps(frameContext.meshes, frameContext.spheres, lights);
+        }
+
+        whittedMaxDepth = std::max(1, settings.maxDepth);
+        wavefrontStats = WavefrontStats{};
+        sceneBuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static ViewContext makeView(const Camera& camera, unsigned width, unsigned height) {
+        ViewContext view;
+        view.width = width;
+        view.height = height;
+        view.aspect = float(width) / float(height);
+        view.scale = std::tan(glm::radians(camera.fov) * 0.5f);
+        view.invView = glm::inverse(camera.getViewMatrix());
+        view.rayOrigin = camera.position;
+        return view;
+    }
+
+    unsigned antialiasingSamples() const {
+        return static_cast<unsigned>(std::max(1, settings.antialiasingSamples));
+    }
+
+    // Sums of `samples` samples per pixel, starting at sample index firstSample, for rows
+    // [y0, y1) of the current frame. onSpan(y, x0, count, sums) is called from worker
+    // threads as soon as a run of pixels of one row is done. Sampler values depend only on
+    // pixel and sample index, and a pixel's samples are summed in sample order, so the sums
+    // are the same bits for any thread count or tile size (checked by RegressionTest).
+    template <typename SpanFn>
+    void traceRows(const Scene& scene, unsigned y0, unsigned y1, unsigned firstSample, unsigned samples, SpanFn&& onSpan)
+    {
+        const unsigned width = frameContext.view.width;
+
+        if (settings.integrator != Integrator::PathTracing && settings.wavefront) {
+            renderWavefront(scene, y0, y1, firstSample, samples, onSpan);
+            return;
+        }
+
+        Parallel::forEach(y1 - y0, [&](size_t row) {
+            TRACE_SCOPE("row");
+            HardwareCounterScope counters(hardwareCounters, HwPhase::TraceRows);
+            const unsigned y = y0 + static_cast<unsigned>(row);
+            thread_local std::vector<glm::vec3> sums;
+            sums.resize(width);
+
+            for (unsigned x = 0; x < width; ++x) {
+                sums[x] = tracePixel(scene, frameContext.view, x, y, firstSample, samples);
+            }
+            onSpan(y, 0u, width, sums.data());
+            });
+    }
+
+    // Sum of `samples` samples of pixel (x, y) of view, starting at sample index firstSample
+    glm::vec3 tracePixel(const Scene& scene, const ViewContext& view, unsigned x, unsigned y, unsigned firstSample, unsigned samples) {
+        const bool pathTracing = settings.integrator == Integrator::PathTracing;
+        const bool jitter = pathTracing || samples > 1;
+        const auto& meshes = frameContext.meshes;
+        const auto& spheres = frameContext.spheres;
+
+        RayCounters::add(RayType::Primary, samples);
+
+        glm::vec3 sum(0.0f);
+        for (unsigned s = 0; s < samples; ++s) {
+            Sampler sampler(settings.sampler, x, y, firstSample + s);
+            glm::vec2 offset = jitter ? sampler.sample2D(DIM_PIXEL) : glm::vec2(0.5f);
+            glm::vec3 dir = view.primaryDir(x + offset.x, y + offset.y);
+
+            sum += pathTracing
+                ? tracePath(view.rayOrigin, dir, meshes, spheres, scene, sampler)
+                : traceRay(view.rayOrigin, dir, meshes, spheres, lights, scene, sampler, 0, 1.0f, view.rayOrigin);
+        }
+        return sum;
+    }
+
+    // Measures what a primary sample costs at depth 1 and at the full depth, then takes the
+    // best quality whose predicted time fits what is left of the budget: antialiasing
+    // samples are given up first, then ray depth, then resolution. Reduced resolutions are
+    // traced with the full frame's aspect and bilinearly scaled up into frame.
+    void renderToDeadline(FrameBuffer& frame, const Scene& scene, std::chrono::steady_clock::time_point start) {
+        using Clock = std::chrono::steady_clock;
+        auto msSince = [](Clock::time_point t) {
+            return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+            };
+
+        const unsigned width = frame.width;
+        const unsigned height = frame.height;
+        const int fullDepth = whittedMaxDepth;
+        const unsigned fullSamples = antialiasingSamples();
+
+        // one untimed sample first, so tables the sampler builds on first use aren't billed as tracing
+        probeSampleCost(scene, 1, 1);
+
+        const Clock::time_point probeStart = Clock::now();
+        const double shallowCost = probeSampleCost(scene, 1);
+        const double deepCost = fullDepth > 1 ? probeSampleCost(scene, fullDepth) : shallowCost;
+
+        // deeper rays only exist where mirrors and glass are, so cost grows roughly linearly
+        auto costAt = [&](int depth) {
+            if (fullDepth == 1) return deepCost;
+            return shallowCost + (deepCost - shallowCost) * double(depth - 1) / double(fullDepth - 1);
+            };
+
+        DeadlineReport report;
+        report.budgetMs = settings.deadlineMs;
+        report.probeMs = msSince(probeStart);
+
+        const double available = settings.deadlineMs * DEADLINE_MARGIN - msSince(start);
+        bool found = false;
+
+        for (float scale : DEADLINE_SCALES) {
+            const unsigned w = std::max(1u, static_cast<unsigned>(std::lround(width * scale)));
+            const unsigned h = std::max(1u, static_cast<unsigned>(std::lround(height * scale)));
+
+            for (int depth = fullDepth; depth >= 1 && !found; --depth) {
+                for (unsigned samples = fullSamples; ; samples /= 2) {
+                    report.resolutionScale = scale;
+                    report.width = w;
+                    report.height = h;
+                    report.samples = samples;
+                    report.maxDepth = depth;
+                    report.predictedMs = double(w) * h * samples * costAt(depth);
+
+                    if (report.predictedMs <= available) {
+                        found = true;
+                        break;
+                    }
+                    if (samples == 1) break;
+                }
+            }
+            if (found) break;
+        }
+
+        // nothing fits: the cheapest setting tried above is the last one left in report
+        whittedMaxDepth = report.maxDepth;
+        const bool scaled = report.width != width || report.height != height;
+        FrameBuffer& target = scaled ? deadlineFrame : frame;
+        if (scaled) {
+            if (deadlineFrame.width != report.width || deadlineFrame.height != report.height) {
+                deadlineFrame.resize(report.width, report.height);
+            }
+            frameContext.view.width = report.width;
+            frameContext.view.height = report.height;
+        }
+
+        const unsigned samples = report.samples;
+        traceRows(scene, 0, report.height, 0, samples, [&](unsigned y, unsigned x0, unsigned count, const glm::vec3* sums) {
+            thread_local std::vector<glm::vec3> line;
+            line.resize(count);
+            for (unsigned i = 0; i < count; ++i) line[i] = sums[i] / float(samples);
+            GammaEncoder::encodeRow(line.data(), count, target.row(y) + size_t(x0) * 4);
+            });
+
+        if (scaled) {
+            Parallel::forEach(height, [&](size_t y) {
+                FrameBuffer::resampleRow(deadlineFrame, frame, static_cast<unsigned>(y));
+                });
+            frameContext.view.width = width;
+            frameContext.view.height = height;
+        }
+        whittedMaxDepth = fullDepth;
+
+        report.actualMs = msSince(start);
+        deadlineReport = report;
+
+        std::cout << "Deadline " << report.budgetMs << " ms: " << report.width << "x" << report.height
+            << " (scale " << report.resolutionScale << "), " << report.samples << " spp, depth " << report.maxDepth
+            << " | probe " << report.probeMs << " ms, predicted " << report.predictedMs << " ms, actual "
+            << report.actualMs << " ms" << (report.met() ? "" : " (missed)") << std::endl;
+    }
+
+    // Wall time of one primary sample at the given depth, from a sparse grid over the frame
+    double probeSampleCost(const Scene& scene, int depth, unsigned probeSamples = DEADLINE_PROBE_SAMPLES) {
+        const unsigned width = frameContext.view.width;
+        const unsigned height = frameContext.view.height;
+        const unsigned stride = std::max(1u, static_cast<unsigned>(std::sqrt(double(width) * height / probeSamples)));
+        const unsigned cols = (width + stride - 1) / stride;
+        const unsigned rows = (height + stride - 1) / stride;
+
+        const int savedDepth = whittedMaxDepth;
+        whittedMaxDepth = depth;
+
+        std::vector<glm::vec3> colors(size_t(cols) * rows);
+        const auto start = std::chrono::steady_clock::now();
+
+        Parallel::forEach(rows, [&](size_t row) {
+            const unsigned y = std::min(height - 1, static_cast<unsigned>(row) * stride + stride / 2);
+            for (unsigned c = 0; c < cols; ++c) {
+                const unsigned x = std::min(width - 1, c * stride + stride / 2);
+                Sampler sampler(settings.sampler, x, y, 0);
+                glm::vec3 dir = frameContext.view.primaryDir(x + 0.5f, y + 0.5f);
+                colors[row * cols + c] = traceRay(frameContext.view.rayOrigin, dir, frameContext.meshes, frameContext.spheres, lights, scene, sampler, 0, 1.0f, frameContext.view.rayOrigin);
+            }
+            });
+
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        whittedMaxDepth = savedDepth;
+        return ms / double(colors.size());
+    }
+
+    // counters of the pixel being traced on this thread; null unless a cost heatmap is rendered
+    static PixelCost*& activeCost() {
+        thread_local PixelCost* cost = nullptr;
+        return cost;
+    }
+
+    // Traces the frame like render() with the counters on (recursive tracer, no accumulation)
+    // and paints the chosen metric over it
+    void renderCostHeatmap(FrameBuffer& frame, const Scene& scene) {
+        const unsigned width = frameContext.view.width;
+        const unsigned height = frameContext.view.height;
+        const unsigned samples = settings.integrator == Integrator::PathTracing
+            ? static_cast<unsigned>(std::max(1, settings.samplesPerFrame))
+            : antialiasingSamples();
+
+        pixelCosts.assign(size_t(width) * height, PixelCost{});
+
+        Parallel::forEach(height, [&](size_t row) {
+            const unsigned y = static_cast<unsigned>(row);
+            for (unsigned x = 0; x < width; ++x) {
+                activeCost() = &pixelCosts[size_t(y) * width + x];
+                tracePixel(scene, frameContext.view, x, y, 0, samples);
+            }
+            activeCost() = nullptr;
+            });
+
+        CostHeatmap::paint(pixelCosts, settings.costMetric, frame);
+        CostHeatmap::printSummary(pixelCosts);
+    }
+
+    void printWavefrontStats() const {
+        std::cout << "Wavefront: " << wavefrontStats.waves << " waves, " << wavefrontStats.rays << " rays, "
+            << wavefrontStats.shadowRays << " shadow rays | generate " << wavefrontStats.generateMs
+            << " ms, intersect " << wavefrontStats.intersectMs << " ms, sort " << wavefrontStats.sortMs
+            << " ms, shade " << wavefrontStats.shadeMs << " ms, shadow " << wavefrontStats.shadowMs
+            << " ms, resolve " << wavefrontStats.resolveMs << " ms" << std::endl;
+    }
+
+    // Breadth-first version of traceRay(). A tile of primary rays is generated into a queue,
+    // intersected in bulk, grouped by material kind and shaded in batches; shading emits
+    // shadow rays and the reflected/refracted rays of the next wave instead of recursing.
+    // The tree of WaveNodes is then collapsed bottom-up with traceRay()'s own formulas.
+    template <typename SpanFn>
+    void renderWavefront(const Scene& scene, unsigned rowBegin, unsigned rowEnd, unsigned firstSample, unsigned samples, SpanFn& onSpan)
+    {
+        using Clock = std::chrono::steady_clock;
+        auto elapsedMs = [](Clock::time_point since) {
+            return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+            };
+
+        struct SecondaryRay {
+            glm::vec3 origin{ 0.0f };
+            glm::vec3 direction{ 0.0f };
+            float environmentIor = 1.0f;
+            int parent = -1;
+            bool refraction = false;
+        };
+
+        struct ChunkOutput {
+            ShadowQueue shadows;
+            std::vector<SecondaryRay> secondary;
+        };
+
+        constexpr size_t CHUNK = 256;
+        auto chunkCount = [](size_t n) { return (n + CHUNK - 1) / CHUNK; };
+
+        const auto& meshes = frameContext.meshes;
+        const auto& spheres = frameContext.spheres;
+        const glm::vec3 rayOrigin = frameContext.view.rayOrigin;
+        const unsigned width = frameContext.view.width;
+        const bool jitter = samples > 1;
+        const unsigned tileSize = static_cast<unsigned>(std::max(8, settings.wavefrontTileSize));
+        const bool useShadowMaps = settings.shadowMode == ShadowMode::ShadowMap && shadowMaps.size() == lights.size();
+
+        std::vector<WaveNode> nodes;
+        std::vector<size_t> waveStart;
+        RayQueue rays;
+        RayQueue nextRays;
+        ShadowQueue shadows;
+        std::vector<HitInfo> hits;
+        std::vector<int> order;
+        std::vector<ChunkOutput> chunks;
+        std::vector<unsigned char> visible;
+
+        for (unsigned y0 = rowBegin; y0 < rowEnd; y0 += tileSize) {
+            for (unsigned x0 = 0; x0 < width; x0 += tileSize) {
+                const unsigned x1 = std::min(width, x0 + tileSize);
+                const unsigned y1 = std::min(rowEnd, y0 + tileSize);
+                TRACE_SCOPE("wavefront tile");
+
+                // generate
+                Clock::time_point t = Clock::now();
+                nodes.clear();
+                waveStart.assign(1, 0);
+                rays.clear();
+
+                {
+                    HardwareCounterScope counters(hardwareCounters, HwPhase::WavefrontGenerate);
+                    for (unsigned y = y0; y < y1; ++y) {
+                        for (unsigned x = x0; x < x1; ++x) {
+                            for (unsigned s = 0; s < samples; ++s) {
+                                Sampler sampler(settings.sampler, x, y, firstSample + s);
+                                glm::vec2 offset = jitter ? sampler.sample2D(DIM_PIXEL) : glm::vec2(0.5f);
+
+                                WaveNode node;
+                                node.pixelX = x;
+                                node.pixelY = y;
+                                node.sample = firstSample + s;
+                                rays.push(rayOrigin, frameContext.view.primaryDir(x + offset.x, y + offset.y), 1.0f, static_cast<int>(nodes.size()));
+                                nodes.push_back(node);
+                            }
+                        }
+                    }
+                }
+                RayCounters::add(RayType::Primary, rays.size());
+                wavefrontStats.generateMs += elapsedMs(t);
+
+                while (rays.size() > 0) {
+                    const size_t count = rays.size();
+                    ++wavefrontStats.waves;
+                    wavefrontStats.rays += count;
+
+                    // intersect
+                    t = Clock::now();
+                    hits.resize(count);
+                    Parallel::forEach(chunkCount(count), [&](size_t c) {
+                        HardwareCounterScope counters(hardwareCounters, HwPhase::WavefrontIntersect);
+                        const size_t end = std::min(count, (c + 1) * CHUNK);
+                        for (size_t i = c * CHUNK; i < end; ++i) {
+                            WaveNode& node = nodes[rays.node[i]];
+                            HitInfo& hit = hits[i];
+                            hit = HitInfo{};
+
+                            if (!intersectScene(rays.origin[i], rays.direction[i], meshes, spheres, hit, node.depth == 0)) {
+                                node.kind = WaveKind::Background;
+                            }
+                            else if (hit.hitLight) {
+                                node.kind = WaveKind::Emitter;
+                            }
+                            else if (hit.features & FEATURE_MIRROR) {
+                                node.kind = WaveKind::Mirror;
+                            }
+                            else if (hit.features & FEATURE_GLASS) {
+                                node.kind = WaveKind::Glass;
+                            }
+                            else {
+                                node.kind = WaveKind::Diffuse;
+                            }
+                            hit.eye = rayOrigin;
+                        }
+                        });
+                    wavefrontStats.intersectMs += elapsedMs(t);
+
+                    // sort by material kind (stable counting sort)
+                    t = Clock::now();
+                    size_t shadedBegin = 0;
+                    {
+                        HardwareCounterScope counters(hardwareCounters, HwPhase::WavefrontSort);
+                        std::array<size_t, static_cast<size_t>(WaveKind::Count) + 1> offsets{};
+                        for (size_t i = 0; i < count; ++i) {
+                            ++offsets[static_cast<size_t>(nodes[rays.node[i]].kind) + 1];
+                        }
+                        for (size_t k = 1; k < offsets.size(); ++k) offsets[k] += offsets[k - 1];
+
+                        shadedBegin = offsets[static_cast<size_t>(WaveKind::Diffuse)];
+                        order.resize(count);
+                        for (size_t i = 0; i < count; ++i) {
+                            order[offsets[static_cast<size_t>(nodes[rays.node[i]].kind)]++] = static_cast<int>(i);
+                        }
+                    }
+                    wavefrontStats.sortMs += elapsedMs(t);
+
+                    // shade
+                    t = Clock::now();
+                    const size_t shadedCount = count - shadedBegin;
+                    chunks.resize(chunkCount(shadedCount));
+                    Parallel::forEach(chunks.size(), [&](size_t c) {
+                        HardwareCounterScope counters(hardwareCounters, HwPhase::WavefrontShade);
+                        ChunkOutput& out = chunks[c];
+                        out.shadows.clear();
+                        out.secondary.clear();
+
+                        const size_t end = shadedBegin + std::min(shadedCount, (c + 1) * CHUNK);
+                        for (size_t k = shadedBegin + c * CHUNK; k < end; ++k) {
+                            const int i = order[k];
+                            const int nodeIndex = rays.node[i];
+                            WaveNode& node = nodes[nodeIndex];
+                            const HitInfo& hit = hits[i];
+                            const Material& mat = hit.material;
+                            const glm::vec3& dirUnit = rays.direction[i];
+
+                            Sampler sampler(settings.sampler, node.pixelX, node.pixelY, node.sample);
+
+                            auto shadeLights = [&](auto specular) {
+                                constexpr bool Specular = decltype(specular)::value;
+
+                                forEachPointLightTerm<Specular>(hit, [&](const glm::vec3& contribution, const glm::vec3& L, float dist, int lightIndex) {
+                                    if (!useShadowMaps) {
+                                        out.shadows.push(hit.p, hit.nGeom, L, dist, contribution, nodeIndex);
+                                        return;
+                                    }
+
+                                    float visibility = shadowMaps[lightIndex].visibility(hit.p, glm::normalize(hit.nGeom), settings.shadowMapFilterRadius);
+                                    if (visibility > 0.0f) node.direct += contribution * visibility;
+                                    });
+                                addAreaLightTerms<Specular>(node.area, hit, meshes, spheres, sampler, node.depth);
+                                };
+
+                            node.direct = scene.ambientLight * mat.diffuseColor;
+                            if (hit.features & FEATURE_SPECULAR) shadeLights(std::true_type{});
+                            else shadeLights(std::false_type{});
+
+                            if (node.kind == WaveKind::Mirror) {
+                                node.reflectWeight = std::clamp(mat.reflectivity, 0.0f, 1.0f);
+
+                                glm::vec3 R = glm::normalize(reflectVec(dirUnit, hit.nGeom));
+                                glm::vec3 o = hit.p + hit.nGeom * (glm::dot(R, hit.nGeom) > 0.0f ? EPS : -EPS);
+                                out.secondary.push_back({ o, R, rays.environmentIor[i], nodeIndex, false });
+                            }
+                            else if (node.kind == WaveKind::Glass) {
+                                float environmentIor = rays.environmentIor[i];
+                                float ior = (mat.refractiveIndex > 1e-4f) ? mat.refractiveIndex : 1.5f;
+                                float n1 = environmentIor;
+                                float n2 = hit.frontFace ? ior : 1.0f;
+
+                                glm::vec3 N = hit.nGeom;
+                                float cosTheta = std::clamp(glm::dot(-dirUnit, N), 0.0f, 1.0f);
+                                float kr = std::clamp(schlick(cosTheta, n1, n2), 0.0f, 1.0f);
+
+                                glm::vec3 R = glm::normalize(reflectVec(dirUnit, N));
+                                glm::vec3 oR = hit.p + N * (glm::dot(R, N) > 0.0f ? EPS : -EPS);
+                                out.secondary.push_back({ oR, R, environmentIor, nodeIndex, false });
+
+                                glm::vec3 T;
+                                node.canRefract = refractVec(dirUnit, N, n1 / n2, T);
+                                if (node.canRefract) {
+                                    T = glm::normalize(T);
+                                    glm::vec3 oT = hit.p + N * (glm::dot(T, N) > 0.0f ? EPS : -EPS);
+                                    out.secondary.push_back({ oT, T, hit.frontFace ? ior : 1.0f, nodeIndex, true });
+                                }
+                                else {
+                                    kr = 1.0f;
+                                }
+
+                                node.reflectWeight = kr;
+                                node.transparency = std::clamp(mat.transparency, 0.0f, 1.0f);
+                                node.tint = mat.diffuseColor;
+                            }
+                        }
+                        });
+
+                    // the next wave: one node per secondary ray, in chunk order so the result
+                    // does not depend on which thread shaded what
+                    waveStart.push_back(nodes.size());
+                    shadows.clear();
+                    nextRays.clear();
+                    for (const auto& out : chunks) {
+                        shadows.append(out.shadows);
+
+                        for (const auto& sr : out.secondary) {
+                            const WaveNode& parent = nodes[sr.parent];
+
+                            WaveNode child;
+                            child.parent = sr.parent;
+                            child.refractionChild = sr.refraction;
+                            child.pixelX = parent.pixelX;
+                            child.pixelY = parent.pixelY;
+                            child.sample = parent.sample;
+                            child.depth = parent.depth + 1;
+
+                            if (child.depth < whittedMaxDepth) {
+                                nextRays.push(sr.origin, sr.direction, sr.environmentIor, static_cast<int>(nodes.size()));
+                                RayCounters::add(sr.refraction ? RayType::Refraction : RayType::Reflection);
+                            }
+                            nodes.push_back(child);
+                        }
+                    }
+                    wavefrontStats.shadeMs += elapsedMs(t);
+
+                    // shadow rays
+                    t = Clock::now();
+                    const size_t shadowCount = shadows.size();
+                    wavefrontStats.shadowRays += shadowCount;
+                    visible.resize(shadowCount);
+                    Parallel::forEach(chunkCount(shadowCount), [&](size_t c) {
+                        HardwareCounterScope counters(hardwareCounters, HwPhase::WavefrontShadow);
+                        const size_t end = std::min(shadowCount, (c + 1) * CHUNK);
+                        for (size_t j = c * CHUNK; j < end; ++j) {
+                            visible[j] = !inShadow(shadows.point[j], shadows.normal[j], shadows.direction[j], shadows.maxDist[j], meshes, spheres);
+                        }
+                        });
+                    for (size_t j = 0; j < shadowCount; ++j) {
+                        if (visible[j]) nodes[shadows.node[j]].direct += shadows.contribution[j];
+                    }
+                    wavefrontStats.shadowMs += elapsedMs(t);
+
+                    std::swap(rays, nextRays);
+                }
+
+                // resolve, deepest wave first
+                t = Clock::now();
+                waveStart.push_back(nodes.size());
+                for (size_t w = waveStart.size() - 1; w-- > 0;) {
+                    const size_t begin = waveStart[w];
+                    const size_t waveSize = waveStart[w + 1] - begin;
+
+                    Parallel::forEach(chunkCount(waveSize), [&](size_t c) {
+                        HardwareCounterScope counters(hardwareCounters, HwPhase::WavefrontResolve);
+                        const size_t end = begin + std::min(waveSize, (c + 1) * CHUNK);
+                        for (size_t i = begin + c * CHUNK; i < end; ++i) {
+                            WaveNode& n = nodes[i];
+                            glm::vec3 direct = n.direct + n.area;
+
+                            switch (n.kind) {
+                            case WaveKind::Background:
+                                n.value = scene.backgroundColor;
+                                break;
+                            case WaveKind::Emitter:
+                                n.value = glm::vec3(1.0f);
+                                break;
+                            case WaveKind::Mirror:
+                                n.value = glm::clamp(direct * (1.0f - n.reflectWeight) + n.reflected * n.reflectWeight, 0.0f, 1.0f);
+                                break;
+                            case WaveKind::Glass: {
+                                glm::vec3 refr = n.canRefract ? n.refracted * n.tint : glm::vec3(0.0f);
+                                glm::vec3 glass = n.reflected * n.reflectWeight + refr * (1.0f - n.reflectWeight);
+                                n.value = glm::clamp(direct * (1.0f - n.transparency) + glass * n.transparency, 0.0f, 1.0f);
+                                break;
+                            }
+                            default:
+                                n.value = glm::clamp(direct, 0.0f, 1.0f);
+                                break;
+                            }
+
+                            if (n.parent >= 0) {
+                                WaveNode& parent = nodes[n.parent];
+                                (n.refractionChild ? parent.refracted : parent.reflected) = n.value;
+                            }
+                        }
+                        });
+                }
+
+                const unsigned tileWidth = x1 - x0;
+                std::vector<glm::vec3> sums(tileWidth);
+                for (unsigned y = y0; y < y1; ++y) {
+                    for (unsigned x = x0; x < x1; ++x) {
+                        const size_t root = (size_t(y - y0) * tileWidth + (x - x0)) * samples;
+                        glm::vec3 color(0.0f);
+                        for (unsigned s = 0; s < samples; ++s) color += nodes[root + s].value;
+                        sums[x - x0] = color;
+                    }
+                    onSpan(y, x0, tileWidth, sums.data());
+                }
+                wavefrontStats.resolveMs += elapsedMs(t);
+            }
+        }
+    }
+
+    // Unidirectional path tracer with next-event estimation. Emissive meshes are sampled by
+    // power and area and combined with BSDF sampling by the power heuristic; point lights
+    // are delta lights and keep the tracer's attenuation so both integrators agree on them.
+    glm::vec3 tracePath(glm::vec3 origin, glm::vec3 dirUnit, const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres, const Scene& scene, const Sampler& sampler)
+    {
+        glm::vec3 radiance(0.0f);
+        glm::vec3 beta(1.0f);
+        bool specularBounce = true;
+        float bsdfPdf = 0.0f;
+
+        const int maxDepth = std::max(1, settings.pathMaxDepth);
+        RayType bounce = RayType::Primary;
+
+        for (int depth = 0; depth < maxDepth; ++depth) {
+            const std::uint32_t dim = DIM_FIRST_BOUNCE + static_cast<std::uint32_t>(depth) * DIMS_PER_BOUNCE;
+            if (depth > 0) RayCounters::add(bounce);
+
+            HitInfo hit;
+            if (!intersectScene(origin, dirUnit, meshes, spheres, hit, (depth == 0))) {
+                radiance += beta * scene.backgroundColor;
+                break;
+            }
+
+            if (PixelCost* cost = activeCost()) cost->depth = std::max(cost->depth, static_cast<std::uint32_t>(depth + 1));
+
+            const Material& mat = hit.material;
+
+            if (mat.isEmissive && hit.areaLight >= 0) {
+                if (hit.frontFace) {
+                    const AreaLight& area = areaLights[hit.areaLight];
+                    float weight = 1.0f;
+                    if (!specularBounce) {
+                        float cosL = std::max(glm::dot(hit.nGeom, -dirUnit), 1e-6f);
+                        float lightPdf = areaLightPdf[hit.areaLight] / area.totalArea * hit.t * hit.t / cosL;
+                        weight = powerHeuristic(bsdfPdf, lightPdf);
+                    }
+                    radiance += beta * area.radiance * weight;
+                }
+                break;
+            }
+
+            // glass, chosen with probability = transparency
+            if (mat.isTransparent && mat.transparency > 0.0f && sampler.sample1D(dim + DIM_GLASS) < std::clamp(mat.transparency, 0.0f, 1.0f)) {
+                float ior = (mat.refractiveIndex > 1e-4f) ? mat.refractiveIndex : 1.5f;
+                float n1 = hit.frontFace ? 1.0f : ior;
+                float n2 = hit.frontFace ? ior : 1.0f;
+
+                glm::vec3 N = hit.nGeom;
+                float kr = schlick(glm::dot(-dirUnit, N), n1, n2);
+                if (mat.isMirror) kr = std::max(kr, std::clamp(mat.reflectivity, 0.0f, 1.0f));
+
+                glm::vec3 T;
+                if (!refractVec(dirUnit, N, n1 / n2, T)) kr = 1.0f;
+
+                if (sampler.sample1D(dim + DIM_FRESNEL) < kr) {
+                    dirUnit = glm::normalize(reflectVec(dirUnit, N));
+                    bounce = RayType::Reflection;
+                }
+                else {
+                    dirUnit = glm::normalize(T);
+                    beta *= mat.diffuseColor;
+                    bounce = RayType::Refraction;
+                }
+
+                origin = hit.p + N * (glm::dot(dirUnit, N) > 0.0f ? EPS : -EPS);
+                specularBounce = true;
+                continue;
+            }
+
+            // mirror, chosen with probability = reflectivity
+            if (mat.isMirror && mat.reflectivity > 0.0f && sampler.sample1D(dim + DIM_MIRROR) < std::clamp(mat.reflectivity, 0.0f, 1.0f)) {
+                dirUnit = glm::normalize(reflectVec(dirUnit, hit.nGeom));
+                origin = hit.p + hit.nGeom * (glm::dot(dirUnit, hit.nGeom) > 0.0f ? EPS : -EPS);
+                specularBounce = true;
+                bounce = RayType::Reflection;
+                continue;
+            }
 
-        return glm::clamp(direct, 0.0f, 1.0f);
+            // Lambertian
+            glm::vec3 N = glm::normalize(hit.nShade);
+            if (glm::dot(N, hit.nGeom) < 0.0f) N = -N;
+
+            const glm::vec3 albedo = hit.hitLight ? glm::vec3(1.0f) : mat.diffuseColor;
+            radiance += beta * albedo * sampleDirectPath(hit, N, meshes, spheres, sampler, dim);
+
+            glm::vec2 u = sampler.sample2D(dim + DIM_BSDF);
+            glm::vec3 newDir = sampleCosineHemisphere(N, u.x, u.y);
+            float cosTheta = glm::dot(newDir, N);
+            if (cosTheta <= 0.0f || glm::dot(newDir, hit.nGeom) <= 0.0f) break;
+
+            beta *= albedo;
+            bsdfPdf = cosTheta / glm::pi<float>();
+            specularBounce = false;
+
+            origin = hit.p + hit.nGeom * EPS;
+            dirUnit = newDir;
+            bounce = RayType::Reflection;
+
+            if (depth + 1 >= settings.rouletteDepth) {
+                float survive = std::clamp(std::max({ beta.r, beta.g, beta.b }), 0.05f, 1.0f);
+                if (sampler.sample1D(dim + DIM_ROULETTE) >= survive) break;
+                beta /= survive;
+            }
+        }
+
+        return radiance;
+    }
+
+    // next-event estimate at a Lambertian vertex, without the albedo
+    glm::vec3 sampleDirectPath(const HitInfo& hit, const glm::vec3& N, const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres, const Sampler& sampler, std::uint32_t dim)
+    {
+        glm::vec3 result(0.0f);
+
+        auto pointLight = [&](const glm::vec3& lightPos, const glm::vec3& lightRadiance) {
+            glm::vec3 toL = lightPos - hit.p;
+            float dist = glm::length(toL);
+            if (dist <= 1e-6f) return;
+            glm::vec3 L = toL / dist;
+
+            float ndotl = glm::dot(N, L);
+            if (ndotl <= 0.0f) return;
+            if (inShadow(hit.p, hit.nGeom, L, dist, meshes, spheres)) return;
+
+            result += lightRadiance * Light::attenuation(dist) * ndotl;
+            };
+
+        if (useLightCut()) {
+            thread_local std::vector<ShadingLight> cut;
+            lightTree.selectLights(hit.p, settings.maxLightsPerHit, settings.lightCutoffRadius, cut);
+            for (const auto& sl : cut) pointLight(sl.position, sl.radiance);
+        }
+        else {
+            for (const auto& l : lights) pointLight(l.position, l.color * l.intensity);
+        }
+
+        if (areaLights.empty()) return result;
+
+        const float uLight = sampler.sample1D(dim + DIM_LIGHT_SELECT);
+        const glm::vec2 uPoint = sampler.sample2D(dim + DIM_LIGHT_POINT);
+
+        size_t li = std::upper_bound(areaLightCdf.begin(), areaLightCdf.end(), uLight) - areaLightCdf.begin();
+        li = std::min(li, areaLights.size() - 1);
+        const AreaLight& area = areaLights[li];
+
+        size_t tri = 0;
+        glm::vec3 y = area.samplePoint(area.areaCdf, uPoint.x, uPoint.y, &tri);
+
+        glm::vec3 toL = y - hit.p;
+        float dist = glm::length(toL);
+        if (dist <= 1e-6f) return result;
+        glm::vec3 L = toL / dist;
+
+        float cosS = glm::dot(N, L);
+        float cosL = glm::dot(area.triangles[tri].normal, -L);
+        if (cosS <= 0.0f || cosL <= 0.0f) return result;
+        if (inShadow(hit.p, hit.nGeom, L, dist, meshes, spheres)) return result;
+
+        float lightPdf = areaLightPdf[li] / area.totalArea * dist * dist / cosL;
+        float bsdfPdf = cosS / glm::pi<float>();
+        float weight = powerHeuristic(lightPdf, bsdfPdf);
+
+        result += area.radiance * (cosS / glm::pi<float>()) * weight / lightPdf;
+        return result;
+    }
+
+    static float powerHeuristic(float pdfA, float pdfB) {
+        float a = pdfA * pdfA;
+        float b = pdfB * pdfB;
+        return (a + b) > 0.0f ? a / (a + b) : 0.0f;
+    }
+
+    static glm::vec3 sampleCosineHemisphere(const glm::vec3& N, float u1, float u2) {
+        float r = std::sqrt(u1);
+        float phi = 2.0f * glm::pi<float>() * u2;
+        float x = r * std::cos(phi);
+        float y = r * std::sin(phi);
+        float z = std::sqrt(std::max(0.0f, 1.0f - u1));
+
+        glm::vec3 T = std::abs(N.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        T = glm::normalize(glm::cross(T, N));
+        glm::vec3 B = glm::cross(N, T);
+        return glm::normalize(T * x + B * y + N * z);
     }
 
     bool intersectScene(const glm::vec3& origin, const glm::vec3& dirUnit, const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres, HitInfo& outHit, bool skipHiddenForPrimary)
@@ -287,8 +1578,15 @@ private:
         bool hitAny = false;
         float nearest = std::numeric_limits<float>::max();
 
+        PixelCost* cost = activeCost();
+        if (cost) ++cost->rays;
+
         for (const auto& s : spheres) {
             if (skipHiddenForPrimary && s.isHidden) continue;
+            if (cost) {
+                ++cost->traversalSteps;
+                ++cost->sphereTests;
+            }
 
             HitInfo h;
             if (intersectSphere(origin, dirUnit, s, h)) {
@@ -296,6 +1594,7 @@ private:
                     nearest = h.t;
                     outHit = h;
                     outHit.hitLight = s.isLight;
+                    outHit.features = s.features;
                     hitAny = true;
                 }
             }
@@ -303,6 +1602,10 @@ private:
 
         for (const auto& m : meshes) {
             if (skipHiddenForPrimary && m.isHidden) continue;
+            if (cost) {
+                ++cost->traversalSteps;
+                cost->triangleTests += m.triangleCount;
+            }
 
             HitInfo h;
             if (intersectMesh(origin, dirUnit, m, h)) {
@@ -310,6 +1613,8 @@ private:
                     nearest = h.t;
                     outHit = h;
                     outHit.hitLight = m.isLight;
+                    outHit.areaLight = m.areaLight;
+                    outHit.features = m.features;
                     hitAny = true;
                 }
             }
@@ -353,13 +1658,15 @@ private:
 
     bool intersectMesh(const glm::vec3& originWorld, const glm::vec3& dirWorldUnit, const RTMesh& rt, HitInfo& outHit)
     {
+        RayCounters::addTriangleTests(rt.triangleCount);
+
         float bestT = std::numeric_limits<float>::max();
         bool hit = false;
 
         glm::vec3 localO = glm::vec3(rt.invModel * glm::vec4(originWorld, 1.0f));
         glm::vec3 localD = glm::normalize(glm::vec3(rt.invModel * glm::vec4(dirWorldUnit, 0.0f)));
 
-        for (const auto& face : rt.mesh->faces) {
+        for (const auto& face : rt.mesh->geometry()) {
             const size_t n = face.vertices.size();
             if (n < 3) continue;
 
@@ -429,42 +1736,168 @@ private:
         return t > EPS_MT;
     }
 
-    glm::vec3 shadeDirect(const HitInfo& hit, const std::vector<Light>& lights, const Scene& scene, const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres)
+    template <bool Specular>
+    glm::vec3 shadeDirect(const HitInfo& hit, const std::vector<Light>& lights, const Scene& scene, const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres, const Sampler& sampler, int depth)
+    {
+        glm::vec3 col = scene.ambientLight * hit.material.diffuseColor;
+
+        const bool useShadowMaps = settings.shadowMode == ShadowMode::ShadowMap && shadowMaps.size() == lights.size();
+
+        forEachPointLightTerm<Specular>(hit, [&](const glm::vec3& c, const glm::vec3& L, float dist, int lightIndex) {
+            float visibility = 1.0f;
+            if (useShadowMaps) {
+                visibility = shadowMaps[lightIndex].visibility(hit.p, glm::normalize(hit.nGeom), settings.shadowMapFilterRadius);
+                if (visibility <= 0.0f) return;
+            }
+            else if (inShadow(hit.p, hit.nGeom, L, dist, meshes, spheres)) {
+                return;
+            }
+
+            col += c * visibility;
+            });
+
+        addAreaLightTerms<Specular>(col, hit, meshes, spheres, sampler, depth);
+        return col;
+    }
+
+    // unshadowed contribution of a point emitter, zero when it is behind the surface
+    template <bool Specular>
+    static glm::vec3 pointLightTerm(const HitInfo& hit, const glm::vec3& N, const glm::vec3& V, const glm::vec3& lightPos, const glm::vec3& radiance, glm::vec3& L, float& dist)
     {
         const Material& m = hit.material;
 
-        glm::vec3 N = glm::normalize(hit.nShade);
-        glm::vec3 V = glm::normalize(scene.getCamera()->position - hit.p);
+        glm::vec3 toL = lightPos - hit.p;
+        dist = glm::length(toL);
+        if (dist <= 1e-6f) return glm::vec3(0.0f);
+        L = toL / dist;
 
-        glm::vec3 col = scene.ambientLight * m.diffuseColor;
+        float ndotl = std::max(glm::dot(N, L), 0.0f);
+        if (ndotl <= 0.0f) return glm::vec3(0.0f);
 
-        for (const auto& Ls : lights) {
-            glm::vec3 toL = Ls.position - hit.p;
-            float dist = glm::length(toL);
-            if (dist <= 1e-6f) continue;
-            glm::vec3 L = toL / dist;
+        float atten = Light::attenuation(dist);
+        glm::vec3 lightCol = radiance * atten;
 
-            if (inShadow(hit.p, hit.nGeom, L, dist, meshes, spheres))
-                continue;
+        // diffuse
+        glm::vec3 c = lightCol * m.diffuseColor * ndotl;
+
+        // spec; Specular is only set for materials with shininess > 1
+        if constexpr (Specular) {
+            glm::vec3 R = reflectVec(-L, N);
+            float spec = std::pow(std::max(glm::dot(V, glm::normalize(R)), 0.0f), m.shininess);
+            c += lightCol * (m.specularColor * spec);
+        }
+        return c;
+    }
+
+    // visit(c, L, dist, lightIndex) for every point light (or light-cut cluster) that
+    // lights the hit before visibility is taken into account
+    template <bool Specular, typename VisitFn>
+    void forEachPointLightTerm(const HitInfo& hit, VisitFn&& visit)
+    {
+        const glm::vec3 N = glm::normalize(hit.nShade);
+        const glm::vec3 V = glm::normalize(hit.eye - hit.p);
+
+        auto one = [&](const glm::vec3& lightPos, const glm::vec3& radiance, int lightIndex) {
+            glm::vec3 L;
+            float dist = 0.0f;
+            glm::vec3 c = pointLightTerm<Specular>(hit, N, V, lightPos, radiance, L, dist);
+            if (c == glm::vec3(0.0f)) return;
+            visit(c, L, dist, lightIndex);
+            };
+
+        if (useLightCut()) {
+            thread_local std::vector<ShadingLight> cut;
+            lightTree.selectLights(hit.p, settings.maxLightsPerHit, settings.lightCutoffRadius, cut);
+            for (const auto& sl : cut) {
+                one(sl.position, sl.radiance, sl.lightIndex);
+            }
+        }
+        else {
+            for (size_t li = 0; li < lights.size(); ++li) {
+                one(lights[li].position, lights[li].color * lights[li].intensity, static_cast<int>(li));
+            }
+        }
+    }
 
-            float ndotl = std::max(glm::dot(N, L), 0.0f);
-            if (ndotl <= 0.0f) continue;
+    template <bool Specular>
+    void addAreaLightTerms(glm::vec3& col, const HitInfo& hit, const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres, const Sampler& sampler, int depth)
+    {
+        if (areaLights.empty()) return;
+
+        const glm::vec3 N = glm::normalize(hit.nShade);
+        const glm::vec3 V = glm::normalize(hit.eye - hit.p);
+        auto lightTerm = [&](const glm::vec3& lightPos, const glm::vec3& radiance, glm::vec3& L, float& dist) {
+            return pointLightTerm<Specular>(hit, N, V, lightPos, radiance, L, dist);
+            };
 
-            float atten = 1.0f / (1.0f + 0.1f * dist + 0.01f * dist * dist);
-            glm::vec3 lightCol = Ls.color * Ls.intensity * atten;
+        const size_t perHit = static_cast<size_t>(std::max(1, settings.maxAreaLightsPerHit));
+        if (areaLights.size() <= perHit) {
+            // two 2D dimensions per area light and recursion level: probes and full set
+            for (size_t a = 0; a < areaLights.size(); ++a) {
+                std::uint32_t dim = DIM_FIRST_BOUNCE + 4u * static_cast<std::uint32_t>(depth * areaLights.size() + a);
+                col += shadeAreaLight(areaLights[a], hit, lightTerm, meshes, spheres, sampler, dim);
+            }
+            return;
+        }
 
-            // diffuse
-            col += lightCol * m.diffuseColor * ndotl;
+        // Too many to shade each: perHit picks from the power CDF, stratified over one
+        // dimension, each divided by its probability so the sum stays unbiased. Probes and
+        // full set get two 2D dimensions per pick and recursion level after it.
+        const std::uint32_t selectDim = DIM_FIRST_BOUNCE + 5u * static_cast<std::uint32_t>(depth * perHit);
+        for (size_t k = 0; k < perHit; ++k) {
+            const float u = sampler.sample1D(selectDim, static_cast<std::uint32_t>(k), static_cast<std::uint32_t>(perHit));
+            size_t li = std::upper_bound(areaLightCdf.begin(), areaLightCdf.end(), u) - areaLightCdf.begin();
+            li = std::min(li, areaLights.size() - 1);
+
+            std::uint32_t dim = selectDim + 1u + 4u * static_cast<std::uint32_t>(k);
+            col += shadeAreaLight(areaLights[li], hit, lightTerm, meshes, spheres, sampler, dim) / (areaLightPdf[li] * float(perHit));
+        }
+    }
 
-            // spec
-            if (m.shininess > 1.0f) {
-                glm::vec3 R = reflectVec(-L, N);
-                float spec = std::pow(std::max(glm::dot(V, glm::normalize(R)), 0.0f), m.shininess);
-                col += lightCol * (m.specularColor * spec);
+    // The emitter acts like its point light spread over the triangles facing the hit.
+    // A few probe samples decide first; the full sample set is only traced when the
+    // probes disagree, i.e. inside a penumbra. Both sets are low-discrepancy sub-samples
+    // of the pixel sample, so they stay stratified without an explicit grid.
+    template <typename LightTermFn>
+    glm::vec3 shadeAreaLight(const AreaLight& area, const HitInfo& hit, LightTermFn& lightTerm, const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres, const Sampler& sampler, std::uint32_t dim)
+    {
+        thread_local std::vector<float> cdf;
+        if (!area.facingCdf(hit.p, cdf)) return glm::vec3(0.0f);
+
+        glm::vec3 sum(0.0f);
+        int taken = 0;
+        int lit = 0;
+        int blocked = 0;
+
+        auto takeSamples = [&](std::uint32_t count, std::uint32_t sampleDim) {
+            for (std::uint32_t k = 0; k < count; ++k) {
+                glm::vec2 u = sampler.sample2D(sampleDim, k, count);
+
+                glm::vec3 L;
+                float dist = 0.0f;
+                glm::vec3 c = lightTerm(area.samplePoint(cdf, u.x, u.y), area.radiance, L, dist);
+                ++taken;
+                if (c == glm::vec3(0.0f)) continue;
+
+                if (inShadow(hit.p, hit.nGeom, L, dist, meshes, spheres)) {
+                    ++blocked;
+                }
+                else {
+                    ++lit;
+                    sum += c;
+                }
             }
+            };
+
+        const std::uint32_t probes = static_cast<std::uint32_t>(std::max(1, settings.areaLightProbes));
+        takeSamples(probes, dim);
+
+        if (lit > 0 && blocked > 0) {
+            const std::uint32_t full = std::max(probes, static_cast<std::uint32_t>(std::max(1, settings.areaLightSamples)));
+            takeSamples(full, dim + 2);
         }
 
-        return col;
+        return taken > 0 ? sum / float(taken) : glm::vec3(0.0f);
     }
 
     bool inShadow(const glm::vec3& p, const glm::vec3& Ng, const glm::vec3& lightDir, float maxDist, const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres)
@@ -472,40 +1905,168 @@ private:
         glm::vec3 n = glm::normalize(Ng);
         glm::vec3 o = p + n * (glm::dot(lightDir, n) > 0.0f ? EPS : -EPS);
 
+        return occluderDistance(o, lightDir, maxDist - EPS, meshes, spheres, true) < maxDist - EPS;
+    }
+
+    // distance to the nearest shadow caster closer than maxDist, or float max when there is none;
+    // anyHit returns the first caster found instead of the nearest one
+    float occluderDistance(const glm::vec3& o, const glm::vec3& dirUnit, float maxDist, const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres, bool anyHit = false)
+    {
+        float nearest = std::numeric_limits<float>::max();
+
+        RayCounters::add(RayType::Shadow);
+        PixelCost* cost = activeCost();
+        if (cost) ++cost->rays;
+
         for (const auto& s : spheres) {
             if (s.material.isTransparent && s.material.transparency > 0.0f) continue;
+            if (cost) {
+                ++cost->traversalSteps;
+                ++cost->sphereTests;
+            }
 
             HitInfo h;
-            if (intersectSphere(o, lightDir, s, h)) {
-                if (h.t > EPS && h.t < maxDist - EPS) return true;
+            if (intersectSphere(o, dirUnit, s, h)) {
+                if (h.t > EPS && h.t < maxDist && h.t < nearest) {
+                    nearest = h.t;
+                    if (anyHit) return nearest;
+                }
             }
         }
 
         for (const auto& m : meshes) {
             if (m.isLight) continue;
             if (m.mesh->material.isTransparent && m.mesh->material.transparency > 0.0f) continue;
+            if (cost) {
+                ++cost->traversalSteps;
+                cost->triangleTests += m.triangleCount;
+            }
 
             HitInfo h;
-            if (intersectMesh(o, lightDir, m, h)) {
-                if (h.t > EPS && h.t < maxDist - EPS) return true;
+            if (intersectMesh(o, dirUnit, m, h)) {
+                if (h.t > EPS && h.t < maxDist && h.t < nearest) {
+                    nearest = h.t;
+                    if (anyHit) return nearest;
+                }
             }
         }
 
-        return false;
+        return nearest;
+    }
+
+    void updateShadowMaps(const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres, const std::vector<Light>& lights)
+    {
+        std::uint64_t signature = shadowCasterSignature(meshes, spheres, lights);
+        if (signature == shadowMapSignature && shadowMaps.size() == lights.size()) return;
+
+        shadowMaps.assign(lights.size(), CubeShadowMap());
+        for (size_t i = 0; i < lights.size(); ++i) {
+            shadowMaps[i].build(lights[i].position, settings.shadowMapResolution,
+                [&](const glm::vec3& o, const glm::vec3& d) {
+                    return occluderDistance(o, d, std::numeric_limits<float>::max(), meshes, spheres);
+                });
+        }
+
+        shadowMapSignature = signature;
+        std::cout << "Shadow maps rebuilt: " << lights.size() << " light(s), "
+            << settings.shadowMapResolution << "^2 per face" << std::endl;
+    }
+
+    bool useLightCut() const {
+        return settings.useLightTree && !lightTree.empty() &&
+            (lights.size() > static_cast<size_t>(std::max(1, settings.maxLightsPerHit)) || settings.lightCutoffRadius > 0.0f);
     }
 
-    static sf::Color toSFMLColor(const glm::vec3& colorLinear01) {
-        glm::vec3 c = glm::clamp(colorLinear01, 0.0f, 1.0f);
+    void updateLightTree()
+    {
+        std::uint64_t h = HASH_SEED;
+        for (const auto& l : lights) {
+            hashBytes(h, &l, sizeof(Light));
+        }
 
-        c.r = std::pow(c.r, 1.0f / 2.2f);
-        c.g = std::pow(c.g, 1.0f / 2.2f);
-        c.b = std::pow(c.b, 1.0f / 2.2f);
+        if (h == lightTreeSignature && lightTree.size() == lights.size()) return;
+
+        lightTree.build(lights);
+        lightTreeSignature = h;
+    }
 
-        auto toByte = [](float v) -> std::uint8_t {
-            v = std::clamp(v, 0.0f, 1.0f);
-            return static_cast<std::uint8_t>(v * 255.0f + 0.5f);
+    static constexpr std::uint64_t HASH_SEED = 1469598103934665603ull;
+
+    static void hashBytes(std::uint64_t& h, const void* data, size_t size) {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            h ^= bytes[i];
+            h *= 1099511628211ull;
+        }
+    }
+
+    std::uint64_t accumulationKey(const Scene& scene, const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres, unsigned width, unsigned height) const
+    {
+        std::uint64_t h = shadowCasterSignature(meshes, spheres, lights);
+        auto mix = [&h](const void* data, size_t size) { hashBytes(h, data, size); };
+        auto mixMaterial = [&mix](const Material& m) {
+            mix(&m.diffuseColor, sizeof(m.diffuseColor));
+            mix(&m.reflectivity, sizeof(float));
+            mix(&m.isMirror, sizeof(bool));
+            mix(&m.transparency, sizeof(float));
+            mix(&m.isTransparent, sizeof(bool));
+            mix(&m.refractiveIndex, sizeof(float));
+            mix(&m.emissionColor, sizeof(m.emissionColor));
+            mix(&m.emissionStrength, sizeof(float));
+            mix(&m.isEmissive, sizeof(bool));
+            };
+
+        for (const auto& m : meshes) mixMaterial(m.mesh->material);
+        for (const auto& s : spheres) mixMaterial(s.material);
+        for (const auto& l : lights) hashBytes(h, &l, sizeof(Light));
+
+        const Camera* camera = scene.getCamera();
+        mix(&camera->position, sizeof(camera->position));
+        mix(&camera->target, sizeof(camera->target));
+        mix(&camera->up, sizeof(camera->up));
+        mix(&camera->fov, sizeof(camera->fov));
+        mix(&scene.backgroundColor, sizeof(scene.backgroundColor));
+        mix(&width, sizeof(width));
+        mix(&height, sizeof(height));
+        mix(&settings.pathMaxDepth, sizeof(int));
+        mix(&settings.rouletteDepth, sizeof(int));
+        mix(&settings.sampler, sizeof(SamplerType));
+        mix(&settings.useLightTree, sizeof(bool));
+        mix(&settings.maxLightsPerHit, sizeof(int));
+        mix(&settings.lightCutoffRadius, sizeof(float));
+        return h;
+    }
+
+    std::uint64_t shadowCasterSignature(const std::vector<RTMesh>& meshes, const std::vector<RTSphere>& spheres, const std::vector<Light>& lights) const
+    {
+        std::uint64_t h = HASH_SEED;
+        auto mix = [&h](const void* data, size_t size) { hashBytes(h, data, size); };
+        auto mixCaster = [&mix](const Material& m) {
+            bool transparent = m.isTransparent && m.transparency > 0.0f;
+            mix(&transparent, sizeof(transparent));
             };
 
-        return { toByte(c.r), toByte(c.g), toByte(c.b) };
+        mix(&settings.shadowMapResolution, sizeof(int));
+
+        for (const auto& m : meshes) {
+            mix(&m.isLight, sizeof(bool));
+            mix(&m.model, sizeof(m.model));
+            mixCaster(m.mesh->material);
+            size_t faceCount = m.mesh->geometry().size();
+            mix(&faceCount, sizeof(faceCount));
+            mix(&m.geometryHash, sizeof(m.geometryHash));
+        }
+
+        for (const auto& s : spheres) {
+            mix(&s.center, sizeof(s.center));
+            mix(&s.radius, sizeof(s.radius));
+            mixCaster(s.material);
+        }
+
+        for (const auto& l : lights) {
+            mix(&l.position, sizeof(l.position));
+        }
+
+        return h;
     }
 };
@@ -0,0 +1,258 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include "Random.h"
+
+enum class SamplerType {
+    Independent,
+    OwenSobol,
+    OwenSobolBlueNoise
+};
+
+// Stateless per-pixel sample generator. Every value is a pure function of
+// (pixel, sample index, dimension, seed), so it does not matter which thread asks for it.
+//
+// OwenSobol decorrelates pixels by seeding the scrambling per pixel.
+// OwenSobolBlueNoise shares one scrambled sequence between all pixels and shifts it
+// per pixel by a blue-noise mask, which pushes the remaining error to high frequencies.
+class Sampler {
+public:
+    Sampler(SamplerType type, std::uint32_t pixelX, std::uint32_t pixelY, std::uint32_t sampleIndex, std::uint32_t seed = 0)
+        : type(type), pixelX(pixelX), pixelY(pixelY), sampleIndex(sampleIndex), seed(seed) {
+        pixelSeed = hash(hash(pixelX ^ hash(pixelY)) ^ seed);
+    }
+
+    // subIndex/subCount split one pixel sample into subCount correlated sub-samples
+    // (e.g. light samples of one hit) that are stratified together
+    float sample1D(std::uint32_t dim, std::uint32_t subIndex = 0, std::uint32_t subCount = 1) const {
+        const std::uint32_t index = sampleIndex * subCount + subIndex;
+
+        if (type == SamplerType::Independent) {
+            return independent(index, dim);
+        }
+
+        const std::uint32_t dimSeed = hash(scrambleSeed() ^ hash(dim * 0x9e3779b9u));
+        std::uint32_t shuffled = nestedUniformScramble(index, hash(dimSeed ^ 0x68bc21ebu));
+        float x = toUnit(nestedUniformScramble(sobol(shuffled, 0), hash(dimSeed ^ 0x02e5be93u)));
+
+        if (type == SamplerType::OwenSobolBlueNoise) {
+            x = wrap(x + blueNoiseOffset(dim));
+        }
+        return x;
+    }
+
+    glm::vec2 sample2D(std::uint32_t dim, std::uint32_t subIndex = 0, std::uint32_t subCount = 1) const {
+        const std::uint32_t index = sampleIndex * subCount + subIndex;
+
+        if (type == SamplerType::Independent) {
+            return glm::vec2(independent(index, dim), independent(index, dim + 1));
+        }
+
+        const std::uint32_t dimSeed = hash(scrambleSeed() ^ hash(dim * 0x9e3779b9u));
+        std::uint32_t shuffled = nestedUniformScramble(index, hash(dimSeed ^ 0x68bc21ebu));
+        glm::vec2 p(
+            toUnit(nestedUniformScramble(sobol(shuffled, 0), hash(dimSeed ^ 0x02e5be93u))),
+            toUnit(nestedUniformScramble(sobol(shuffled, 1), hash(dimSeed ^ 0x967a889bu))));
+
+        if (type == SamplerType::OwenSobolBlueNoise) {
+            p.x = wrap(p.x + blueNoiseOffset(dim));
+            p.y = wrap(p.y + blueNoiseOffset(dim + 1));
+        }
+        return p;
+    }
+
+    static constexpr int BLUE_NOISE_SIZE = 64;
+
+    // void-and-cluster rank mask, values (rank + 0.5) / N; built once on first use
+    static const std::vector<float>& blueNoiseMask() {
+        static const std::vector<float> mask = buildBlueNoiseMask();
+        return mask;
+    }
+
+private:
+    SamplerType type;
+    std::uint32_t pixelX;
+    std::uint32_t pixelY;
+    std::uint32_t sampleIndex;
+    std::uint32_t seed;
+    std::uint32_t pixelSeed;
+
+    std::uint32_t scrambleSeed() const {
+        return type == SamplerType::OwenSobolBlueNoise ? hash(seed ^ 0x5bd1e995u) : pixelSeed;
+    }
+
+    float independent(std::uint32_t index, std::uint32_t dim) const {
+        Pcg32 rng(Pcg32::mix64((std::uint64_t(index) << 32) ^ pixelSeed), dim);
+        return rng.nextFloat();
+    }
+
+    float blueNoiseOffset(std::uint32_t dim) const {
+        const std::uint32_t shift = hash(dim * 0x85ebca6bu ^ seed);
+        const int x = static_cast<int>((pixelX + (shift & 0xffffu)) % BLUE_NOISE_SIZE);
+        const int y = static_cast<int>((pixelY + (shift >> 16)) % BLUE_NOISE_SIZE);
+        return blueNoiseMask()[y * BLUE_NOISE_SIZE + x];
+    }
+
+    static float wrap(float x) {
+        x -= std::floor(x);
+        return x < 1.0f ? x : 0.0f;
+    }
+
+    static float toUnit(std::uint32_t x) {
+        return static_cast<float>(x >> 8) * (1.0f / 16777216.0f);
+    }
+
+    static std::uint32_t hash(std::uint32_t x) {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    static std::uint32_t reverseBits(std::uint32_t x) {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+        x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+        return (x >> 16) | (x << 16);
+    }
+
+    // Burley 2020, "Practical Hash-based Owen Scrambling"
+    static std::uint32_t laineKarrasPermutation(std::uint32_t x, std::uint32_t s) {
+        x += s;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return x;
+    }
+
+    static std::uint32_t nestedUniformScramble(std::uint32_t x, std::uint32_t s) {
+        return reverseBits(laineKarrasPermutation(reverseBits(x), s));
+    }
+
+    // first two Sobol dimensions (van der Corput and x + 1)
+    static std::uint32_t sobol(std::uint32_t index, int dim) {
+        static const std::array<std::array<std::uint32_t, 32>, 2> directions = buildDirections();
+
+        std::uint32_t x = 0;
+        for (int bit = 0; index != 0; index >>= 1, ++bit) {
+            if (index & 1u) x ^= directions[dim][bit];
+        }
+        return x;
+    }
+
+    static std::array<std::array<std::uint32_t, 32>, 2> buildDirections() {
+        std::array<std::array<std::uint32_t, 32>, 2> v{};
+        for (int i = 0; i < 32; ++i) {
+            v[0][i] = 1u << (31 - i);
+        }
+
+        v[1][0] = 1u << 31;
+        for (int i = 1; i < 32; ++i) {
+            v[1][i] = v[1][i - 1] ^ (v[1][i - 1] >> 1);
+        }
+        return v;
+    }
+
+    static std::vector<float> buildBlueNoiseMask() {
+        const int size = BLUE_NOISE_SIZE;
+        const int count = size * size;
+        const float sigma = 1.5f;
+
+        std::vector<float> kernel(count);
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                int dx = std::min(x, size - x);
+                int dy = std::min(y, size - y);
+                kernel[y * size + x] = std::exp(-float(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+            }
+        }
+
+        std::vector<unsigned char> ones(count, 0);
+        std::vector<float> energy(count, 0.0f);
+
+        auto toggle = [&](int p, float sign) {
+            const int px = p % size, py = p / size;
+            for (int y = 0; y < size; ++y) {
+                const int ky = ((y - py) % size + size) % size;
+                for (int x = 0; x < size; ++x) {
+                    const int kx = ((x - px) % size + size) % size;
+                    energy[y * size + x] += sign * kernel[ky * size + kx];
+                }
+            }
+            };
+
+        auto tightestCluster = [&]() {
+            int best = -1;
+            for (int i = 0; i < count; ++i) {
+                if (ones[i] && (best < 0 || energy[i] > energy[best])) best = i;
+            }
+            return best;
+            };
+
+        auto largestVoid = [&]() {
+            int best = -1;
+            for (int i = 0; i < count; ++i) {
+                if (!ones[i] && (best < 0 || energy[i] < energy[best])) best = i;
+            }
+            return best;
+            };
+
+        // initial pattern: ~10% random points relaxed until the tightest cluster is the largest void
+        Pcg32 rng(0x2545f491u, 7);
+        const int initial = count / 10;
+        for (int placed = 0; placed < initial;) {
+            int p = static_cast<int>(rng.nextUint() % count);
+            if (ones[p]) continue;
+            ones[p] = 1;
+            toggle(p, 1.0f);
+            ++placed;
+        }
+
+        for (int iter = 0; iter < count; ++iter) {
+            int cluster = tightestCluster();
+            ones[cluster] = 0;
+            toggle(cluster, -1.0f);
+
+            int hole = largestVoid();
+            ones[hole] = 1;
+            toggle(hole, 1.0f);
+            if (hole == cluster) break;
+        }
+
+        std::vector<int> rank(count, 0);
+        std::vector<unsigned char> prototype = ones;
+        std::vector<float> prototypeEnergy = energy;
+
+        // ranks below the initial count: peel clusters off the prototype
+        for (int r = initial - 1; r >= 0; --r) {
+            int cluster = tightestCluster();
+            ones[cluster] = 0;
+            toggle(cluster, -1.0f);
+            rank[cluster] = r;
+        }
+
+        // remaining ranks: keep filling the largest void
+        ones = prototype;
+        energy = prototypeEnergy;
+        for (int r = initial; r < count; ++r) {
+            int hole = largestVoid();
+            ones[hole] = 1;
+            toggle(hole, 1.0f);
+            rank[hole] = r;
+        }
+
+        std::vector<float> mask(count);
+        for (int i = 0; i < count; ++i) {
+            mask[i] = (rank[i] + 0.5f) / float(count);
+        }
+        return mask;
+    }
+};
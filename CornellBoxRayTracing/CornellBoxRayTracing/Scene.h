@@ -35,15 +35,24 @@ public:
 		return meshes;
 	}
 
+	void collectMeshes(std::vector<Mesh*>& out) const {
+		out.clear();
+		collectMeshes(root.get(), out);
+	}
+
 	std::vector<Light> getLights() const {
 		std::vector<Light> lightComponents;
+		collectLights(lightComponents);
+		return lightComponents;
+	}
+
+	void collectLights(std::vector<Light>& out) const {
+		out.clear();
 		for (auto* lightNode : lights) {
 			if (lightNode && lightNode->light) {
-				lightComponents.push_back(*lightNode->light);
+				out.push_back(*lightNode->light);
 			}
 		}
-
-		return lightComponents;
 	}
 private:
 	void collectMeshes(SceneNode* node, std::vector<Mesh*>& meshes) const {
@@ -0,0 +1,638 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <system_error>
+#include <type_traits>
+#include "Scene.h"
+#include "Trace.h"
+#include "Parallel.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define SCENE_FILE_MMAP 1
+#else
+#define SCENE_FILE_MMAP 0
+#endif
+
+// Read-only view of a whole file: memory-mapped where the platform allows it, read into
+// memory otherwise
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#if SCENE_FILE_MMAP
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void* mapped = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) return false;
+
+        bytes = static_cast<const std::uint8_t*>(mapped);
+        length = static_cast<size_t>(st.st_size);
+        return true;
+#else
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in) return false;
+
+        const std::streamsize size = in.tellg();
+        if (size <= 0) return false;
+        in.seekg(0);
+
+        // 64-byte blocks, so the records inside are as aligned as they are in the file
+        buffer.resize((static_cast<size_t>(size) + sizeof(Block) - 1) / sizeof(Block));
+        if (!in.read(reinterpret_cast<char*>(buffer.data()), size)) return false;
+
+        bytes = reinterpret_cast<const std::uint8_t*>(buffer.data());
+        length = static_cast<size_t>(size);
+        return true;
+#endif
+    }
+
+    void close() {
+#if SCENE_FILE_MMAP
+        if (bytes) munmap(const_cast<std::uint8_t*>(bytes), length);
+#else
+        std::vector<Block>().swap(buffer);
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const std::uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+
+    // asks for a range to be read ahead in one go rather than a page at a time on first touch
+    void willNeed(const void* at, size_t size) const {
+#if SCENE_FILE_MMAP
+        const auto page = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+        const auto begin = reinterpret_cast<std::uintptr_t>(at) / page * page;
+        madvise(reinterpret_cast<void*>(begin), reinterpret_cast<std::uintptr_t>(at) + size - begin, MADV_WILLNEED);
+#else
+        (void)at;
+        (void)size;
+#endif
+    }
+
+private:
+    const std::uint8_t* bytes = nullptr;
+    size_t length = 0;
+#if !SCENE_FILE_MMAP
+    struct alignas(64) Block { std::uint8_t bytes[64]; };
+    std::vector<Block> buffer;
+#endif
+};
+
+// Binary scene: the node hierarchy with transforms, meshes, materials and lights, the scene's
+// light list, camera and ambient and background colours. Meshes with identical faces share one
+// geometry block. A block holds FaceRecords followed by the vertices in Vertex's own memory
+// layout, both starting on a GEOMETRY_ALIGNMENT boundary. Loaded meshes keep the file mapped
+// and read their faces in place as Mesh::packedFaces; nothing is copied per face.
+//
+// Layout: Header, names, NodeRecords in pre-order (parents first), light node indices,
+// GeometryRecords, geometry blocks. The checksum covers everything from the names to the
+// geometry table; geometry is only bounds-checked, so large files open without a pass over
+// every byte.
+class SceneFile {
+public:
+    static constexpr std::uint32_t VERSION = 2;
+    static constexpr std::uint64_t GEOMETRY_ALIGNMENT = 64;
+
+    struct CameraRecord {
+        glm::vec3 position{ 0.0f };
+        glm::vec3 target{ 0.0f };
+        glm::vec3 up{ 0.0f, 1.0f, 0.0f };
+        float fov = 45.0f;
+        float aspectRatio = 1.0f;
+        float nearPlane = 0.1f;
+        float farPlane = 100.0f;
+        std::uint32_t projection = 0;
+    };
+
+    struct Header {
+        char magic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+        std::uint32_t version = VERSION;
+        std::uint32_t nodeCount = 0;
+        std::uint32_t lightCount = 0;
+        std::uint32_t geometryCount = 0;
+        std::uint64_t namesOffset = 0;
+        std::uint64_t namesSize = 0;
+        std::uint64_t nodesOffset = 0;
+        std::uint64_t lightsOffset = 0;
+        std::uint64_t geometryOffset = 0;
+        std::uint64_t fileSize = 0;
+        std::uint64_t checksum = 0;
+        CameraRecord camera;
+        glm::vec3 ambientLight{ 0.0f };
+        glm::vec3 backgroundColor{ 0.0f };
+    };
+
+    enum MaterialFlags : std::uint32_t {
+        MATERIAL_MIRROR = 1u << 0,
+        MATERIAL_TRANSPARENT = 1u << 1,
+        MATERIAL_EMISSIVE = 1u << 2
+    };
+
+    struct MaterialRecord {
+        glm::vec3 diffuseColor{ 0.0f };
+        glm::vec3 specularColor{ 0.0f };
+        glm::vec3 emissionColor{ 0.0f };
+        float shininess = 0.0f;
+        float reflectivity = 0.0f;
+        float transparency = 0.0f;
+        float refractiveIndex = 1.0f;
+        float emissionStrength = 0.0f;
+        std::uint32_t flags = 0;
+    };
+
+    enum NodeFlags : std::uint32_t {
+        NODE_MESH = 1u << 0,
+        NODE_LIGHT = 1u << 1
+    };
+
+    struct NodeRecord {
+        std::int32_t parent = -1;
+        std::uint32_t flags = 0;
+        std::uint32_t nameOffset = 0;
+        std::uint32_t nameSize = 0;
+        glm::mat4 transform{ 1.0f };
+
+        std::int32_t geometry = -1;
+        std::uint32_t meshNameOffset = 0;
+        std::uint32_t meshNameSize = 0;
+        glm::vec3 position{ 0.0f };
+        glm::vec3 rotation{ 0.0f };
+        glm::vec3 scale{ 1.0f };
+        MaterialRecord material;
+
+        glm::vec3 lightPosition{ 0.0f };
+        glm::vec3 lightColor{ 1.0f };
+        float lightIntensity = 1.0f;
+    };
+
+    struct GeometryRecord {
+        std::uint64_t faceCount = 0;
+        std::uint64_t vertexCount = 0;
+        std::uint64_t facesOffset = 0;
+        std::uint64_t verticesOffset = 0;
+    };
+
+    // read in place by loaded meshes, so a record is the mesh's own packed face
+    using FaceRecord = PackedFace;
+
+    static_assert(sizeof(CameraRecord) == 56, "scene file layout changed");
+    static_assert(sizeof(Header) == 160, "scene file layout changed");
+    static_assert(sizeof(MaterialRecord) == 60, "scene file layout changed");
+    static_assert(sizeof(NodeRecord) == 216, "scene file layout changed");
+    static_assert(sizeof(GeometryRecord) == 32, "scene file layout changed");
+    static_assert(sizeof(FaceRecord) == 32 && std::is_trivially_copyable<FaceRecord>::value, "scene file layout changed");
+    static_assert(sizeof(Vertex) == 44 && std::is_trivially_copyable<Vertex>::value, "vertices are stored as Vertex");
+
+    // Written to path + ".tmp" and renamed over path, so a failed save keeps the old file
+    static bool save(const Scene& scene, const std::string& path) {
+        TRACE_SCOPE("SceneFile::save");
+        const auto start = std::chrono::steady_clock::now();
+
+        std::string names;
+        std::vector<NodeRecord> nodes;
+        std::vector<const SceneNode*> order;
+        std::vector<const Mesh*> geometrySources;
+        std::unordered_map<std::uint64_t, std::vector<std::int32_t>> geometryByHash;
+
+        auto addName = [&](const std::string& name, std::uint32_t& offset, std::uint32_t& size) {
+            offset = static_cast<std::uint32_t>(names.size());
+            size = static_cast<std::uint32_t>(name.size());
+            names += name;
+            };
+
+        auto geometryOf = [&](const Mesh& mesh) {
+            const std::uint64_t hash = hashFaces(mesh);
+            auto& candidates = geometryByHash[hash];
+            for (std::int32_t g : candidates) {
+                if (sameFaces(*geometrySources[g], mesh)) return g;
+            }
+            candidates.push_back(static_cast<std::int32_t>(geometrySources.size()));
+            geometrySources.push_back(&mesh);
+            return candidates.back();
+            };
+
+        // pre-order, so every parent is written before its children
+        std::vector<std::pair<const SceneNode*, std::int32_t>> stack{ { scene.getRoot(), -1 } };
+        while (!stack.empty()) {
+            const auto [node, parent] = stack.back();
+            stack.pop_back();
+
+            NodeRecord r;
+            r.parent = parent;
+            r.transform = node->transform;
+            addName(node->name, r.nameOffset, r.nameSize);
+
+            if (node->mesh) {
+                const Mesh& mesh = *node->mesh;
+                r.flags |= NODE_MESH;
+                r.geometry = geometryOf(mesh);
+                addName(mesh.name, r.meshNameOffset, r.meshNameSize);
+                r.position = mesh.position;
+                r.rotation = mesh.rotation;
+                r.scale = mesh.scale;
+                r.material = toRecord(mesh.material);
+            }
+            if (node->light) {
+                r.flags |= NODE_LIGHT;
+                r.lightPosition = node->light->position;
+                r.lightColor = node->light->color;
+                r.lightIntensity = node->light->intensity;
+            }
+
+            const std::int32_t index = static_cast<std::int32_t>(nodes.size());
+            nodes.push_back(r);
+            order.push_back(node);
+            for (auto it = node->children.rbegin(); it != node->children.rend(); ++it) {
+                stack.push_back({ it->get(), index });
+            }
+        }
+
+        std::vector<std::uint32_t> lightNodes;
+        for (const SceneNode* light : scene.lights) {
+            auto it = std::find(order.begin(), order.end(), light);
+            if (it != order.end() && (*it)->light) lightNodes.push_back(static_cast<std::uint32_t>(it - order.begin()));
+        }
+
+        Header header;
+        header.nodeCount = static_cast<std::uint32_t>(nodes.size());
+        header.lightCount = static_cast<std::uint32_t>(lightNodes.size());
+        header.geometryCount = static_cast<std::uint32_t>(geometrySources.size());
+        header.namesOffset = sizeof(Header);
+        header.namesSize = names.size();
+        header.nodesOffset = align(header.namesOffset + header.namesSize, alignof(NodeRecord));
+        header.lightsOffset = header.nodesOffset + nodes.size() * sizeof(NodeRecord);
+        header.geometryOffset = align(header.lightsOffset + lightNodes.size() * sizeof(std::uint32_t), alignof(GeometryRecord));
+
+        std::vector<GeometryRecord> geometry(geometrySources.size());
+        std::uint64_t offset = header.geometryOffset + geometry.size() * sizeof(GeometryRecord);
+        for (size_t g = 0; g < geometry.size(); ++g) {
+            GeometryRecord& r = geometry[g];
+            r.faceCount = geometrySources[g]->geometry().size();
+            for (const auto& face : geometrySources[g]->geometry()) r.vertexCount += face.vertices.size();
+
+            r.facesOffset = align(offset, GEOMETRY_ALIGNMENT);
+            r.verticesOffset = align(r.facesOffset + r.faceCount * sizeof(FaceRecord), GEOMETRY_ALIGNMENT);
+            offset = r.verticesOffset + r.vertexCount * sizeof(Vertex);
+        }
+        header.fileSize = offset;
+
+        header.camera = toRecord(*scene.getCamera());
+        header.ambientLight = scene.ambientLight;
+        header.backgroundColor = scene.backgroundColor;
+
+        std::uint64_t checksum = CHECKSUM_SEED;
+        checksum = fnv(checksum, names.data(), names.size());
+        checksum = fnv(checksum, nodes.data(), nodes.size() * sizeof(NodeRecord));
+        checksum = fnv(checksum, lightNodes.data(), lightNodes.size() * sizeof(std::uint32_t));
+        checksum = fnv(checksum, geometry.data(), geometry.size() * sizeof(GeometryRecord));
+        header.checksum = checksum;
+
+        const std::string tmpPath = path + ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                std::cerr << "Cannot open file: " << tmpPath << std::endl;
+                return false;
+            }
+
+            std::uint64_t written = 0;
+            auto put = [&](const void* data, size_t size) {
+                out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+                written += size;
+                };
+            auto padTo = [&](std::uint64_t at) {
+                static const char zeros[GEOMETRY_ALIGNMENT] = {};
+                put(zeros, static_cast<size_t>(at - written));
+                };
+
+            put(&header, sizeof(header));
+            put(names.data(), names.size());
+            padTo(header.nodesOffset);
+            put(nodes.data(), nodes.size() * sizeof(NodeRecord));
+            put(lightNodes.data(), lightNodes.size() * sizeof(std::uint32_t));
+            padTo(header.geometryOffset);
+            put(geometry.data(), geometry.size() * sizeof(GeometryRecord));
+
+            std::vector<FaceRecord> faces;
+            for (size_t g = 0; g < geometry.size(); ++g) {
+                const MeshGeometry meshFaces = geometrySources[g]->geometry();
+                faces.resize(meshFaces.size());
+
+                std::uint32_t first = 0;
+                for (size_t f = 0; f < meshFaces.size(); ++f) {
+                    const FaceView face = meshFaces[f];
+                    faces[f].normal = face.normal;
+                    faces[f].color = face.color;
+                    faces[f].firstVertex = first;
+                    faces[f].vertexCount = static_cast<std::uint32_t>(face.vertices.size());
+                    first += faces[f].vertexCount;
+                }
+
+                padTo(geometry[g].facesOffset);
+                put(faces.data(), faces.size() * sizeof(FaceRecord));
+                padTo(geometry[g].verticesOffset);
+                for (const auto& face : meshFaces) put(face.vertices.data(), face.vertices.size() * sizeof(Vertex));
+            }
+
+            out.flush();
+            if (!out) {
+                std::cerr << "Write failed: " << tmpPath << std::endl;
+                return false;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, path, ec);
+        if (ec) {
+            std::cerr << "Cannot replace scene file " << path << ": " << ec.message() << std::endl;
+            std::filesystem::remove(tmpPath, ec);
+            return false;
+        }
+
+        std::cout << "Scene saved: " << path << " | Nodes: " << nodes.size() << " | Geometry blocks: " << geometry.size()
+            << " | " << header.fileSize / 1024 << " KiB in "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+        return true;
+    }
+
+    // Replaces the contents of scene; false, with the scene untouched, when the file is missing,
+    // truncated, corrupt or from another format version
+    static bool load(const std::string& path, Scene& scene) {
+        TRACE_SCOPE("SceneFile::load");
+        const auto start = std::chrono::steady_clock::now();
+
+        // kept mapped for as long as a loaded mesh reads its faces from it
+        auto file = std::make_shared<MappedFile>();
+        if (!file->open(path)) {
+            std::cerr << "Cannot open scene file: " << path << std::endl;
+            return false;
+        }
+
+        const std::uint8_t* data = file->data();
+        Header header;
+        if (file->size() < sizeof(Header)) return invalid(path);
+        std::memcpy(&header, data, sizeof(Header));
+
+        if (std::memcmp(header.magic, Header{}.magic, sizeof(header.magic)) != 0 || header.version != VERSION) return invalid(path);
+        if (header.fileSize != file->size() || header.nodeCount == 0) return invalid(path);
+        if (!inFile(header, header.namesOffset, header.namesSize, 1) ||
+            !inFile(header, header.nodesOffset, header.nodeCount, sizeof(NodeRecord)) ||
+            !inFile(header, header.lightsOffset, header.lightCount, sizeof(std::uint32_t)) ||
+            !inFile(header, header.geometryOffset, header.geometryCount, sizeof(GeometryRecord))) {
+            return invalid(path);
+        }
+
+        const char* names = reinterpret_cast<const char*>(data + header.namesOffset);
+        const auto* nodes = reinterpret_cast<const NodeRecord*>(data + header.nodesOffset);
+        const auto* lightNodes = reinterpret_cast<const std::uint32_t*>(data + header.lightsOffset);
+        const auto* geometry = reinterpret_cast<const GeometryRecord*>(data + header.geometryOffset);
+
+        std::uint64_t checksum = CHECKSUM_SEED;
+        checksum = fnv(checksum, names, header.namesSize);
+        checksum = fnv(checksum, nodes, header.nodeCount * sizeof(NodeRecord));
+        checksum = fnv(checksum, lightNodes, header.lightCount * sizeof(std::uint32_t));
+        checksum = fnv(checksum, geometry, header.geometryCount * sizeof(GeometryRecord));
+        if (checksum != header.checksum) return invalid(path);
+
+        for (std::uint32_t g = 0; g < header.geometryCount; ++g) {
+            const GeometryRecord& r = geometry[g];
+            if (r.facesOffset % GEOMETRY_ALIGNMENT != 0 || r.verticesOffset % GEOMETRY_ALIGNMENT != 0 ||
+                !inFile(header, r.facesOffset, r.faceCount, sizeof(FaceRecord)) ||
+                !inFile(header, r.verticesOffset, r.vertexCount, sizeof(Vertex))) {
+                return invalid(path);
+            }
+        }
+
+        auto name = [&](std::uint32_t offset, std::uint32_t size) {
+            return std::string(names + offset, size);
+            };
+        auto validName = [&](std::uint32_t offset, std::uint32_t size) {
+            return std::uint64_t(offset) + size <= header.namesSize;
+            };
+
+        // everything is built aside first, so a bad record leaves the scene as it was
+        std::vector<std::unique_ptr<SceneNode>> built(header.nodeCount);
+        std::vector<std::pair<Mesh*, std::int32_t>> meshes;
+        for (std::uint32_t i = 0; i < header.nodeCount; ++i) {
+            const NodeRecord& r = nodes[i];
+            if ((i == 0) != (r.parent < 0) || r.parent >= std::int32_t(i) || !validName(r.nameOffset, r.nameSize)) return invalid(path);
+
+            auto node = std::make_unique<SceneNode>(name(r.nameOffset, r.nameSize));
+            node->setTransform(r.transform);
+
+            if (r.flags & NODE_MESH) {
+                if (r.geometry < 0 || std::uint32_t(r.geometry) >= header.geometryCount || !validName(r.meshNameOffset, r.meshNameSize)) {
+                    return invalid(path);
+                }
+
+                node->mesh = std::make_unique<Mesh>();
+                Mesh& mesh = *node->mesh;
+                mesh.name = name(r.meshNameOffset, r.meshNameSize);
+                mesh.position = r.position;
+                mesh.rotation = r.rotation;
+                mesh.scale = r.scale;
+                mesh.material = fromRecord(r.material);
+                meshes.push_back({ node->mesh.get(), r.geometry });
+            }
+            if (r.flags & NODE_LIGHT) {
+                node->light = std::make_unique<Light>(r.lightPosition, r.lightColor, r.lightIntensity);
+            }
+            built[i] = std::move(node);
+        }
+
+        // only the face records are read here, to check their vertex ranges; vertices stay on
+        // disk until the tracer first reads them
+        std::vector<std::shared_ptr<const PackedGeometry>> packed(header.geometryCount);
+        std::atomic<bool> geometryOk{ true };
+        Parallel::forEach(packed.size(), [&](size_t g) {
+            packed[g] = packGeometry(data, geometry[g], file);
+            if (!packed[g]) geometryOk = false;
+            });
+        if (!geometryOk) return invalid(path);
+
+        size_t faceTotal = 0;
+        for (const auto& m : meshes) {
+            m.first->packedFaces = packed[m.second];
+            faceTotal += m.first->geometry().size();
+        }
+
+        std::vector<SceneNode*> lights;
+        for (std::uint32_t l = 0; l < header.lightCount; ++l) {
+            if (lightNodes[l] >= header.nodeCount || !built[lightNodes[l]]->light) return invalid(path);
+            lights.push_back(built[lightNodes[l]].get());
+        }
+
+        // parents come first, so children can be moved into them back to front
+        std::vector<SceneNode*> raw(header.nodeCount);
+        for (std::uint32_t i = 0; i < header.nodeCount; ++i) raw[i] = built[i].get();
+        for (std::uint32_t i = header.nodeCount; i-- > 1;) {
+            SceneNode* parent = raw[nodes[i].parent];
+            built[i]->parent = parent;
+            parent->children.push_back(std::move(built[i]));
+        }
+        for (SceneNode* node : raw) std::reverse(node->children.begin(), node->children.end());
+
+        scene.root = std::move(built[0]);
+        scene.lights = std::move(lights);
+        *scene.camera = fromRecord(header.camera);
+        scene.ambientLight = header.ambientLight;
+        scene.backgroundColor = header.backgroundColor;
+
+        std::cout << "Scene loaded: " << path << " | Nodes: " << header.nodeCount << " | Faces: " << faceTotal << " | "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+        return true;
+    }
+
+private:
+    static constexpr std::uint64_t CHECKSUM_SEED = 1469598103934665603ull;
+
+    static std::uint64_t align(std::uint64_t offset, std::uint64_t alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    static bool inFile(const Header& header, std::uint64_t offset, std::uint64_t count, std::uint64_t size) {
+        return offset <= header.fileSize && count <= (header.fileSize - offset) / size;
+    }
+
+    static bool invalid(const std::string& path) {
+        std::cerr << "Invalid or incompatible scene file: " << path << std::endl;
+        return false;
+    }
+
+    // null when a face reaches past the block's vertices
+    static std::shared_ptr<const PackedGeometry> packGeometry(const std::uint8_t* data, const GeometryRecord& r,
+        const std::shared_ptr<MappedFile>& file) {
+        auto packed = std::make_shared<PackedGeometry>();
+        packed->faces = reinterpret_cast<const FaceRecord*>(data + r.facesOffset);
+        packed->faceCount = static_cast<size_t>(r.faceCount);
+        packed->vertices = reinterpret_cast<const Vertex*>(data + r.verticesOffset);
+        packed->vertexCount = static_cast<size_t>(r.vertexCount);
+        packed->storage = file;
+        file->willNeed(packed->faces, packed->faceCount * sizeof(FaceRecord));
+
+        for (size_t f = 0; f < packed->faceCount; ++f) {
+            const FaceRecord& fr = packed->faces[f];
+            if (std::uint64_t(fr.firstVertex) + fr.vertexCount > r.vertexCount) return nullptr;
+        }
+        return packed;
+    }
+
+    static std::uint64_t hashFaces(const Mesh& mesh) {
+        std::uint64_t h = CHECKSUM_SEED;
+        for (const auto& face : mesh.geometry()) {
+            const std::uint64_t count = face.vertices.size();
+            h = fnv(h, &count, sizeof(count));
+            h = fnv(h, face.vertices.data(), face.vertices.size() * sizeof(Vertex));
+        }
+        return h;
+    }
+
+    static bool sameFaces(const Mesh& a, const Mesh& b) {
+        const MeshGeometry facesA = a.geometry();
+        const MeshGeometry facesB = b.geometry();
+        if (facesA.size() != facesB.size()) return false;
+        for (size_t f = 0; f < facesA.size(); ++f) {
+            const FaceView fa = facesA[f];
+            const FaceView fb = facesB[f];
+            if (fa.vertices.size() != fb.vertices.size() || fa.normal != fb.normal || fa.color != fb.color) return false;
+            if (std::memcmp(fa.vertices.data(), fb.vertices.data(), fa.vertices.size() * sizeof(Vertex)) != 0) return false;
+        }
+        return true;
+    }
+
+    static std::uint64_t fnv(std::uint64_t h, const void* data, size_t size) {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            h ^= bytes[i];
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    static MaterialRecord toRecord(const Material& m) {
+        MaterialRecord r;
+        r.diffuseColor = m.diffuseColor;
+        r.specularColor = m.specularColor;
+        r.emissionColor = m.emissionColor;
+        r.shininess = m.shininess;
+        r.reflectivity = m.reflectivity;
+        r.transparency = m.transparency;
+        r.refractiveIndex = m.refractiveIndex;
+        r.emissionStrength = m.emissionStrength;
+        r.flags = (m.isMirror ? MATERIAL_MIRROR : 0u) | (m.isTransparent ? MATERIAL_TRANSPARENT : 0u) | (m.isEmissive ? MATERIAL_EMISSIVE : 0u);
+        return r;
+    }
+
+    static Material fromRecord(const MaterialRecord& r) {
+        Material m;
+        m.diffuseColor = r.diffuseColor;
+        m.specularColor = r.specularColor;
+        m.emissionColor = r.emissionColor;
+        m.shininess = r.shininess;
+        m.reflectivity = r.reflectivity;
+        m.transparency = r.transparency;
+        m.refractiveIndex = r.refractiveIndex;
+        m.emissionStrength = r.emissionStrength;
+        m.isMirror = (r.flags & MATERIAL_MIRROR) != 0;
+        m.isTransparent = (r.flags & MATERIAL_TRANSPARENT) != 0;
+        m.isEmissive = (r.flags & MATERIAL_EMISSIVE) != 0;
+        return m;
+    }
+
+    static CameraRecord toRecord(const Camera& c) {
+        CameraRecord r;
+        r.position = c.position;
+        r.target = c.target;
+        r.up = c.up;
+        r.fov = c.fov;
+        r.aspectRatio = c.aspectRatio;
+        r.nearPlane = c.nearPlane;
+        r.farPlane = c.farPlane;
+        r.projection = static_cast<std::uint32_t>(c.projectionType);
+        return r;
+    }
+
+    static Camera fromRecord(const CameraRecord& r) {
+        Camera c;
+        c.position = r.position;
+        c.target = r.target;
+        c.up = r.up;
+        c.fov = r.fov;
+        c.aspectRatio = r.aspectRatio;
+        c.nearPlane = r.nearPlane;
+        c.farPlane = r.farPlane;
+        c.projectionType = r.projection == 0 ? Camera::ProjectionType::Perspective : Camera::ProjectionType::Orthographic;
+        return c;
+    }
+};
@@ -9,9 +9,9 @@
 class SceneNode {
 public:
 	std::string name;
-	glm::mat4 transform = glm::mat4(1.0f);
+	glm::mat4 transform = glm::mat4(1.0f);     // relative to the parent; change it with setTransform()
 	std::vector<std::unique_ptr<SceneNode>> children;
-	std::unique_ptr<Mesh> mesh;
+	std::shared_ptr<Mesh> mesh;     // shared with scene snapshots that were taken while it was unchanged
 	std::unique_ptr<Light> light;
 
 	SceneNode* parent = nullptr;
@@ -20,6 +20,7 @@ public:
 
 	void addChild(std::unique_ptr<SceneNode> child) {
 		child->parent = this;
+		child->markDirty();
 		children.push_back(std::move(child));
 	}
 
@@ -31,11 +32,18 @@ public:
 		return ptr;
 	}
 
-	glm::mat4 getWorldTransform() const {
-		if (parent) {
-			return parent->getWorldTransform() * transform;
+	void setTransform(const glm::mat4& local) {
+		transform = local;
+		markDirty();
+	}
+
+	// cached; the parent chain is only multiplied again after a transform on it was set
+	const glm::mat4& getWorldTransform() const {
+		if (worldDirty) {
+			world = parent ? parent->getWorldTransform() * transform : transform;
+			worldDirty = false;
 		}
-		return transform;
+		return world;
 	}
 
 	void update(float deltaTime) {
@@ -56,4 +64,15 @@ public:
 			);
 		}
 	}
+
+private:
+	mutable glm::mat4 world = glm::mat4(1.0f);
+	mutable bool worldDirty = true;
+
+	// a clean node has clean ancestors, so a dirty one has no clean descendants
+	void markDirty() {
+		if (worldDirty) return;
+		worldDirty = true;
+		for (auto& child : children) child->markDirty();
+	}
 };
\ No newline at end of file
@@ -0,0 +1,159 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+#include "Scene.h"
+#include "Trace.h"
+
+// An immutable copy of a scene as the tracer sees it: every mesh and light node in the
+// scene's pre-order under one root, with world transforms, the light list, camera and colours.
+// Nothing in it changes after capture, so any number of renders on any threads can read it
+// while the live scene is edited.
+class SceneSnapshot {
+public:
+    std::uint64_t version() const { return snapshotVersion; }
+    const Scene& scene() const { return flat; }
+
+    // meshes taken over from the previous snapshot, meshes copied for this one and, of those,
+    // the ones whose faces had to be copied too
+    size_t sharedMeshes() const { return shared; }
+    size_t copiedMeshes() const { return copied; }
+    size_t copiedGeometry() const { return copiedFaces; }
+
+private:
+    friend class SceneSnapshotter;
+
+    Scene flat;
+    std::vector<std::unique_ptr<SceneNode>> detached;   // lights that are not in the tree
+    std::uint64_t snapshotVersion = 0;
+    size_t shared = 0;
+    size_t copied = 0;
+    size_t copiedFaces = 0;
+};
+
+// Captures snapshots of one live scene. A mesh is copied the first time it is captured and
+// after it changed; otherwise the new snapshot shares the copy of the previous one. Copies
+// keep their faces in an immutable shared block that is only copied again when the geometry
+// revision changed, so moving a mesh or editing its material copies neither its faces nor
+// anything else in the scene. Packed faces of a loaded mesh are immutable already and are
+// shared as they are. Capture on the thread that edits the scene.
+class SceneSnapshotter {
+public:
+    std::shared_ptr<const SceneSnapshot> capture(const Scene& live) {
+        TRACE_SCOPE("SceneSnapshotter::capture");
+        auto snapshot = std::make_shared<SceneSnapshot>();
+        snapshot->snapshotVersion = ++version;
+        Scene& flat = snapshot->flat;
+
+        std::unordered_map<const SceneNode*, SceneNode*> copies;
+        addNodes(live.getRoot(), *snapshot, copies);
+
+        // lights that are not in the tree still light the scene
+        for (const SceneNode* light : live.lights) {
+            if (!light) continue;
+            auto it = copies.find(light);
+            if (it == copies.end()) {
+                it = copies.emplace(light, copyNode(*light, light->getWorldTransform(), *snapshot, nullptr)).first;
+            }
+            flat.lights.push_back(it->second);
+        }
+
+        *flat.camera = *live.getCamera();
+        flat.ambientLight = live.ambientLight;
+        flat.backgroundColor = live.backgroundColor;
+
+        // meshes that are gone from the scene would otherwise be kept alive by the cache
+        for (auto it = cache.begin(); it != cache.end();) {
+            if (it->second.capture != version) it = cache.erase(it);
+            else ++it;
+        }
+        return snapshot;
+    }
+
+private:
+    struct CachedMesh {
+        std::weak_ptr<Mesh> source;
+        std::shared_ptr<Mesh> copy;
+        std::shared_ptr<const std::vector<Face>> faces;     // of geometryRevision
+        std::shared_ptr<const PackedGeometry> packed;       // instead of faces for loaded meshes
+        std::uint64_t geometryRevision = 0;
+        std::uint64_t capture = 0;
+    };
+
+    std::unordered_map<const Mesh*, CachedMesh> cache;
+    std::uint64_t version = 0;
+
+    // world transforms come from the nodes' caches, which only change with the scene
+    void addNodes(const SceneNode* node, SceneSnapshot& snapshot, std::unordered_map<const SceneNode*, SceneNode*>& copies) {
+        if (node->mesh || node->light) {
+            copies[node] = copyNode(*node, node->getWorldTransform(), snapshot, snapshot.flat.getRoot());
+        }
+        for (const auto& child : node->children) {
+            addNodes(child.get(), snapshot, copies);
+        }
+    }
+
+    // a child of parent, or kept aside in the snapshot when parent is null
+    SceneNode* copyNode(const SceneNode& node, const glm::mat4& world, SceneSnapshot& snapshot, SceneNode* parent) {
+        auto copy = std::make_unique<SceneNode>(node.name);
+        copy->setTransform(world);
+        if (node.light) copy->light = std::make_unique<Light>(*node.light);
+        if (node.mesh) copy->mesh = meshCopy(node.mesh, snapshot);
+
+        SceneNode* ptr = copy.get();
+        if (parent) parent->addChild(std::move(copy));
+        else snapshot.detached.push_back(std::move(copy));
+        return ptr;
+    }
+
+    std::shared_ptr<Mesh> meshCopy(const std::shared_ptr<Mesh>& mesh, SceneSnapshot& snapshot) {
+        CachedMesh& cached = cache[mesh.get()];
+
+        // a different mesh at the address of a deleted one has a different owner
+        const bool sameSource = !cached.source.owner_before(mesh) && !mesh.owner_before(cached.source);
+        const bool sameGeometry = sameSource && (cached.faces || cached.packed) && cached.geometryRevision == mesh->geometryRevision;
+        if (sameGeometry && cached.copy && sameState(*cached.copy, *mesh)) {
+            ++snapshot.shared;
+            cached.capture = version;
+            return cached.copy;
+        }
+
+        if (!sameGeometry) {
+            cached.packed = mesh->sharedFaces ? nullptr : mesh->packedFaces;
+            cached.faces = nullptr;
+            if (!cached.packed) {
+                cached.faces = mesh->sharedFaces ? mesh->sharedFaces : std::make_shared<const std::vector<Face>>(mesh->faces);
+                ++snapshot.copiedFaces;
+            }
+            cached.geometryRevision = mesh->geometryRevision;
+        }
+
+        auto copy = std::make_shared<Mesh>();
+        copy->name = mesh->name;
+        copy->position = mesh->position;
+        copy->rotation = mesh->rotation;
+        copy->scale = mesh->scale;
+        copy->material = mesh->material;
+        copy->geometryRevision = mesh->geometryRevision;
+        copy->sharedFaces = cached.faces;
+        copy->packedFaces = cached.packed;
+
+        cached.source = mesh;
+        cached.copy = std::move(copy);
+        cached.capture = version;
+        ++snapshot.copied;
+        return cached.copy;
+    }
+
+    static bool sameState(const Mesh& a, const Mesh& b) {
+        const Material& m = a.material;
+        const Material& n = b.material;
+        return a.name == b.name && a.position == b.position && a.rotation == b.rotation && a.scale == b.scale &&
+            m.diffuseColor == n.diffuseColor && m.specularColor == n.specularColor && m.shininess == n.shininess &&
+            m.reflectivity == n.reflectivity && m.isMirror == n.isMirror &&
+            m.transparency == n.transparency && m.isTransparent == n.isTransparent && m.refractiveIndex == n.refractiveIndex &&
+            m.emissionColor == n.emissionColor && m.emissionStrength == n.emissionStrength && m.isEmissive == n.isEmissive;
+    }
+};
@@ -0,0 +1,132 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <array>
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include "Parallel.h"
+
+// Distance-to-occluder cube map around a point light. Faces are +X, -X, +Y, -Y, +Z, -Z.
+class CubeShadowMap {
+public:
+    glm::vec3 lightPosition{ 0.0f };
+
+    int getResolution() const { return resolution; }
+
+    // nearestOccluder(origin, dirUnit) must return the distance to the closest shadow caster
+    // along the ray, or std::numeric_limits<float>::max() if there is none
+    template <typename OccluderFn>
+    void build(const glm::vec3& lightPos, int res, OccluderFn&& nearestOccluder) {
+        lightPosition = lightPos;
+        resolution = std::max(1, res);
+
+        for (auto& face : faces) {
+            face.assign(static_cast<size_t>(resolution) * resolution, std::numeric_limits<float>::max());
+        }
+
+        const size_t rows = static_cast<size_t>(6) * resolution;
+        Parallel::forEach(rows, [&](size_t row) {
+            const int face = static_cast<int>(row / resolution);
+            const int y = static_cast<int>(row % resolution);
+            float* out = faces[face].data() + static_cast<size_t>(y) * resolution;
+
+            const float t = 2.0f * (y + 0.5f) / float(resolution) - 1.0f;
+            for (int x = 0; x < resolution; ++x) {
+                const float s = 2.0f * (x + 0.5f) / float(resolution) - 1.0f;
+                out[x] = nearestOccluder(lightPosition, glm::normalize(texelDirection(face, s, t)));
+            }
+            });
+    }
+
+    // Fraction of the light visible from p, percentage-closer filtered over (2r+1)^2 bilinear taps
+    float visibility(const glm::vec3& p, const glm::vec3& nGeomUnit, int filterRadius = 1) const {
+        if (resolution <= 0) return 1.0f;
+
+        glm::vec3 toP = p - lightPosition;
+        float dist = glm::length(toP);
+        if (dist <= 1e-6f) return 1.0f;
+
+        // normal offset by roughly one texel footprint keeps lit surfaces from self-shadowing
+        const float texelWorld = dist * 2.0f / float(resolution);
+        glm::vec3 n = glm::dot(nGeomUnit, toP) > 0.0f ? -nGeomUnit : nGeomUnit;
+        glm::vec3 q = p + n * (1.5f * texelWorld) - lightPosition;
+        float qDist = glm::length(q);
+
+        float s, t;
+        int face = faceFor(q, s, t);
+
+        const float fx = (s * 0.5f + 0.5f) * resolution - 0.5f;
+        const float fy = (t * 0.5f + 0.5f) * resolution - 0.5f;
+        const float bias = 0.5f * texelWorld + 1e-3f;
+
+        filterRadius = std::max(0, filterRadius);
+        float lit = 0.0f;
+        int taps = 0;
+        for (int dy = -filterRadius; dy <= filterRadius; ++dy) {
+            for (int dx = -filterRadius; dx <= filterRadius; ++dx) {
+                lit += bilinearCompare(face, fx + dx, fy + dy, qDist - bias);
+                ++taps;
+            }
+        }
+
+        return lit / float(taps);
+    }
+
+    size_t memoryBytes() const {
+        size_t bytes = 0;
+        for (const auto& face : faces) bytes += face.capacity() * sizeof(float);
+        return bytes;
+    }
+
+private:
+    int resolution = 0;
+    std::array<std::vector<float>, 6> faces;
+
+    float depthAt(int face, int x, int y) const {
+        x = std::clamp(x, 0, resolution - 1);
+        y = std::clamp(y, 0, resolution - 1);
+        return faces[face][static_cast<size_t>(y) * resolution + x];
+    }
+
+    float bilinearCompare(int face, float fx, float fy, float receiverDist) const {
+        const float x0f = std::floor(fx);
+        const float y0f = std::floor(fy);
+        const float ax = fx - x0f;
+        const float ay = fy - y0f;
+        const int x0 = static_cast<int>(x0f);
+        const int y0 = static_cast<int>(y0f);
+
+        auto lit = [&](int x, int y) { return receiverDist <= depthAt(face, x, y) ? 1.0f : 0.0f; };
+
+        float top = lit(x0, y0) * (1.0f - ax) + lit(x0 + 1, y0) * ax;
+        float bottom = lit(x0, y0 + 1) * (1.0f - ax) + lit(x0 + 1, y0 + 1) * ax;
+        return top * (1.0f - ay) + bottom * ay;
+    }
+
+    static glm::vec3 texelDirection(int face, float s, float t) {
+        switch (face) {
+        case 0:  return glm::vec3(1.0f, -t, -s);
+        case 1:  return glm::vec3(-1.0f, -t, s);
+        case 2:  return glm::vec3(s, 1.0f, t);
+        case 3:  return glm::vec3(s, -1.0f, -t);
+        case 4:  return glm::vec3(s, -t, 1.0f);
+        default: return glm::vec3(-s, -t, -1.0f);
+        }
+    }
+
+    static int faceFor(const glm::vec3& d, float& s, float& t) {
+        const float ax = std::abs(d.x), ay = std::abs(d.y), az = std::abs(d.z);
+
+        if (ax >= ay && ax >= az) {
+            if (d.x > 0.0f) { s = -d.z / ax; t = -d.y / ax; return 0; }
+            s = d.z / ax; t = -d.y / ax; return 1;
+        }
+        if (ay >= az) {
+            if (d.y > 0.0f) { s = d.x / ay; t = d.z / ay; return 2; }
+            s = d.x / ay; t = -d.z / ay; return 3;
+        }
+        if (d.z > 0.0f) { s = d.x / az; t = -d.y / az; return 4; }
+        s = -d.x / az; t = -d.y / az; return 5;
+    }
+};
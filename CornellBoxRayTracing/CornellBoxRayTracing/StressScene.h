@@ -0,0 +1,243 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include "Scene.h"
+#include "Mesh.h"
+
+struct StressSceneSettings {
+    size_t primitives = 1000;       // spheres plus triangles, roughly; lights come on top
+    unsigned seed = 1;
+    int lights = 4;
+    float roomSize = 15.0f;
+    float sphereShare = 0.3f;       // of the primitives, the rest after boxes goes to meshes
+    float boxShare = 0.2f;
+    float mirrorShare = 0.1f;       // of the objects
+    float glassShare = 0.1f;
+};
+
+struct StressSceneStats {
+    size_t spheres = 0;
+    size_t boxes = 0;
+    size_t meshes = 0;
+    size_t triangles = 0;           // boxes and meshes
+    size_t lights = 0;
+    double buildMs = 0.0;
+};
+
+// Fills a room with a reproducible crowd of objects for scaling tests: analytic spheres,
+// boxes, tessellated meshes of up to MESH_TRIANGLES triangles each and emissive light boxes,
+// with some mirror and glass materials. Everything goes under one GROUP node, so clear()
+// takes it out again. Sphere and box node counts are capped, so very large counts end up
+// mostly as mesh triangles.
+class StressScene {
+public:
+    static constexpr const char* GROUP = "StressScene";
+    static constexpr size_t MAX_SPHERES = 20000;
+    static constexpr size_t MAX_BOXES = 20000;
+    static constexpr size_t MESH_TRIANGLES = 100000;
+
+    static StressSceneStats populate(Scene& scene, const StressSceneSettings& s) {
+        const auto start = std::chrono::steady_clock::now();
+        clear(scene);
+
+        StressSceneStats stats;
+        std::mt19937 rng(s.seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        const size_t total = std::max<size_t>(1, s.primitives);
+        const size_t sphereCount = std::min(MAX_SPHERES, static_cast<size_t>(total * s.sphereShare));
+        const size_t boxCount = std::min(MAX_BOXES, static_cast<size_t>(total * s.boxShare) / 12);
+        const size_t used = sphereCount + boxCount * 12;
+        const size_t meshTriangles = total > used ? total - used : 0;
+        const size_t meshCount = meshTriangles >= 32 ? (meshTriangles + MESH_TRIANGLES - 1) / MESH_TRIANGLES : 0;
+
+        // spacing of the objects if they were spread evenly over the room
+        const float half = s.roomSize * 0.5f;
+        const size_t objects = std::max<size_t>(1, sphereCount + boxCount + meshCount);
+        const float spacing = s.roomSize / std::cbrt(float(objects));
+
+        auto randomPosition = [&](float margin) {
+            const float range = std::max(0.0f, half - margin);
+            return glm::vec3((unit(rng) * 2.0f - 1.0f) * range, (unit(rng) * 2.0f - 1.0f) * range, (unit(rng) * 2.0f - 1.0f) * range);
+            };
+
+        auto randomMaterial = [&](Mesh& mesh) {
+            mesh.material.diffuseColor = glm::vec3(0.2f + 0.8f * unit(rng), 0.2f + 0.8f * unit(rng), 0.2f + 0.8f * unit(rng));
+            const float pick = unit(rng);
+            if (pick < s.mirrorShare) {
+                mesh.material.isMirror = true;
+                mesh.material.reflectivity = 0.8f;
+            }
+            else if (pick < s.mirrorShare + s.glassShare) {
+                mesh.material.isTransparent = true;
+                mesh.material.transparency = 0.9f;
+                mesh.material.refractiveIndex = 1.5f;
+            }
+            };
+
+        SceneNode* group = scene.getRoot()->createChild(GROUP);
+
+        // the tracer only reads position and scale of spheres; the coarse mesh is for the editor view
+        const Mesh sphereBase = Mesh::createSphereUV(1.0f, 4, 8);
+        for (size_t i = 0; i < sphereCount; ++i) {
+            const float radius = spacing * (0.1f + 0.2f * unit(rng));
+            auto n = group->createChild("Sphere_" + std::to_string(i));
+            n->mesh = std::make_unique<Mesh>(sphereBase);
+            n->mesh->name = n->name;
+            n->mesh->scale = glm::vec3(radius);
+            n->mesh->position = randomPosition(radius);
+            randomMaterial(*n->mesh);
+        }
+        stats.spheres = sphereCount;
+
+        Mesh boxBase = Mesh::createLightBox(1.0f, 1.0f, 1.0f);
+        for (auto& face : boxBase.faces) face.calculateNormal();
+        for (size_t i = 0; i < boxCount; ++i) {
+            const glm::vec3 size = glm::vec3(unit(rng), unit(rng), unit(rng)) * spacing * 0.3f + spacing * 0.1f;
+            auto n = group->createChild("Box_" + std::to_string(i));
+            n->mesh = std::make_unique<Mesh>(boxBase);
+            n->mesh->name = n->name;
+            n->mesh->scale = size;
+            n->mesh->rotation = glm::vec3(unit(rng), unit(rng), unit(rng)) * glm::two_pi<float>();
+            n->mesh->position = randomPosition(glm::length(size) * 0.5f);
+            randomMaterial(*n->mesh);
+        }
+        stats.boxes = boxCount;
+        stats.triangles += boxCount * 12;
+
+        for (size_t i = 0; i < meshCount; ++i) {
+            const size_t triangles = meshTriangles / meshCount + (i < meshTriangles % meshCount ? 1 : 0);
+            const float size = std::min(s.roomSize * 0.3f, spacing * 0.6f);
+
+            auto n = group->createChild("Blob_" + std::to_string(i));
+            n->mesh = std::make_unique<Mesh>(createBlob(triangles, rng));
+            n->mesh->name = n->name;
+            n->mesh->scale = glm::vec3(0.6f + 0.4f * unit(rng), 0.6f + 0.4f * unit(rng), 0.6f + 0.4f * unit(rng)) * size * 0.5f;
+            n->mesh->rotation = glm::vec3(unit(rng), unit(rng), unit(rng)) * glm::two_pi<float>();
+            n->mesh->position = randomPosition(size * 0.5f);
+            randomMaterial(*n->mesh);
+
+            stats.triangles += n->mesh->faces.size();
+        }
+        stats.meshes = meshCount;
+
+        // lights just below the ceiling, sharing the brightness of the room's own
+        const int lightCount = std::clamp(s.lights, 0, 64);
+        Mesh lightBase = Mesh::createLightBox(0.6f, 0.1f, 0.6f);
+        for (auto& face : lightBase.faces) face.calculateNormal();
+        for (int i = 0; i < lightCount; ++i) {
+            glm::vec3 position = randomPosition(1.0f);
+            position.y = half - 0.5f;
+
+            auto n = group->createChild("StressLight_" + std::to_string(i));
+            n->light = std::make_unique<Light>(position, glm::vec3(1.0f, 0.95f, 0.85f), 1.5f / std::sqrt(float(lightCount)));
+            n->mesh = std::make_unique<Mesh>(lightBase);
+            n->mesh->name = "LightCapsule_" + n->name;
+            n->mesh->position = position;
+            n->mesh->material.diffuseColor = n->light->color;
+            n->mesh->material.isEmissive = true;
+            n->mesh->material.emissionColor = n->light->color;
+            n->mesh->material.emissionStrength = n->light->intensity;
+            scene.addLight(n);
+        }
+        stats.lights = static_cast<size_t>(lightCount);
+
+        stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Stress scene: " << stats.spheres << " spheres, " << stats.boxes << " boxes, " << stats.meshes
+            << " meshes, " << stats.triangles << " triangles, " << stats.lights << " lights in " << stats.buildMs
+            << " ms" << std::endl;
+        return stats;
+    }
+
+    // removes what populate() added, lights included
+    static void clear(Scene& scene) {
+        auto& children = scene.getRoot()->children;
+        for (auto it = children.begin(); it != children.end(); ++it) {
+            if ((*it)->name != GROUP) continue;
+
+            for (auto& child : (*it)->children) {
+                if (child->light) scene.removeLight(child.get());
+            }
+            children.erase(it);
+            return;
+        }
+    }
+
+private:
+    // A lumpy sphere of about `triangles` triangles with analytic normals; calculateVertexNormals
+    // is quadratic in the vertex count and far too slow at these sizes
+    static Mesh createBlob(size_t triangles, std::mt19937& rng) {
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        // a stacks x 2*stacks grid has 4 * stacks * (stacks - 1) triangles
+        const int stacks = std::max(3, static_cast<int>(std::sqrt(float(triangles) / 4.0f)) + 1);
+        const int slices = 2 * stacks;
+
+        const glm::vec3 lump(1.0f + 3.0f * unit(rng), 1.0f + 3.0f * unit(rng), 1.0f + 3.0f * unit(rng));
+        const float amount = 0.15f * unit(rng);
+        auto surface = [&](float theta, float phi) {
+            const glm::vec3 n(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+            const float r = 1.0f + amount * std::sin(lump.x * n.x + lump.y * n.y * 2.0f) * std::cos(lump.z * n.z);
+            return n * r;
+            };
+
+        std::vector<glm::vec3> positions;
+        positions.reserve(size_t(stacks + 1) * (slices + 1));
+        for (int i = 0; i <= stacks; ++i) {
+            for (int j = 0; j <= slices; ++j) {
+                positions.push_back(surface(glm::pi<float>() * i / stacks, glm::two_pi<float>() * j / slices));
+            }
+        }
+
+        // vertex normals from the surrounding grid, without searching for shared positions
+        std::vector<glm::vec3> normals(positions.size());
+        const int stride = slices + 1;
+        for (int i = 0; i <= stacks; ++i) {
+            for (int j = 0; j <= slices; ++j) {
+                const glm::vec3& p = positions[size_t(i) * stride + j];
+                if (i == 0 || i == stacks) {
+                    normals[size_t(i) * stride + j] = glm::normalize(p);
+                    continue;
+                }
+                const glm::vec3 du = positions[size_t(i) * stride + (j + 1) % slices] - positions[size_t(i) * stride + (j + slices - 1) % slices];
+                const glm::vec3 dv = positions[size_t(i + 1) * stride + j] - positions[size_t(i - 1) * stride + j];
+                glm::vec3 n = glm::cross(du, dv);
+                if (glm::dot(n, p) < 0.0f) n = -n;
+                normals[size_t(i) * stride + j] = glm::normalize(n);
+            }
+        }
+
+        Mesh mesh;
+        mesh.faces.reserve(size_t(stacks) * slices * 2);
+        auto addTri = [&](int a, int b, int c) {
+            Face f;
+            f.vertices = { Vertex(positions[a], normals[a]), Vertex(positions[b], normals[b]), Vertex(positions[c], normals[c]) };
+            f.calculateNormal();
+            if (glm::dot(f.normal, positions[a]) < 0.0f) {
+                std::swap(f.vertices[1], f.vertices[2]);
+                f.normal = -f.normal;
+            }
+            mesh.faces.push_back(std::move(f));
+            };
+
+        for (int i = 0; i < stacks; ++i) {
+            for (int j = 0; j < slices; ++j) {
+                const int i0 = i * stride + j;
+                const int i1 = i0 + 1;
+                const int i2 = (i + 1) * stride + j;
+                const int i3 = i2 + 1;
+
+                if (i != 0) addTri(i0, i2, i1);
+                if (i != stacks - 1) addTri(i1, i2, i3);
+            }
+        }
+        return mesh;
+    }
+};
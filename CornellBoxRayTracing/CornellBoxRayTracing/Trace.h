@@ -0,0 +1,195 @@
+#pragma once
+#include <string>
+#include <iostream>
+
+// Scoped trace markers written out as Chrome trace JSON, which chrome://tracing and
+// ui.perfetto.dev open directly. Build with ENABLE_TRACING=1 to record; otherwise
+// TRACE_SCOPE expands to nothing and Trace::writeJson only reports that.
+#ifndef ENABLE_TRACING
+#define ENABLE_TRACING 0
+#endif
+
+#if ENABLE_TRACING
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#endif
+
+class Trace {
+public:
+    static constexpr bool enabled() { return ENABLE_TRACING != 0; }
+
+#if ENABLE_TRACING
+    static constexpr size_t EVENTS_PER_THREAD = 1 << 14;
+
+    static std::int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - epoch()).count();
+    }
+
+    // name must outlive the trace, i.e. be a string literal
+    static void record(const char* name, std::int64_t start, std::int64_t end) {
+        Buffer& b = *localBuffer().buffer;
+        const std::uint64_t i = b.head.load(std::memory_order_relaxed);
+        Event& e = b.events[i % EVENTS_PER_THREAD];
+
+        // per-event sequence lock, odd while the slot is being written
+        e.seq.store(2 * i + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        e.name.store(name, std::memory_order_relaxed);
+        e.start.store(start, std::memory_order_relaxed);
+        e.duration.store(end - start, std::memory_order_relaxed);
+        e.seq.store(2 * i + 2, std::memory_order_release);
+        b.head.store(i + 1, std::memory_order_release);
+    }
+
+    // The last EVENTS_PER_THREAD events of every thread. Safe to call while other threads
+    // record; events overwritten during the dump are skipped.
+    static bool writeJson(const std::string& filename) {
+        std::ofstream out(filename);
+        if (!out) {
+            std::cerr << "Cannot write trace: " << filename << std::endl;
+            return false;
+        }
+
+        std::vector<Buffer*> buffers;
+        {
+            std::lock_guard<std::mutex> lock(registry().mutex);
+            for (auto& b : registry().all) buffers.push_back(b.get());
+        }
+
+        size_t written = 0;
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        for (const Buffer* b : buffers) {
+            out << (written++ ? "," : "") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->lane
+                << ",\"args\":{\"name\":\"thread " << b->lane << "\"}}";
+
+            const std::uint64_t head = b->head.load(std::memory_order_acquire);
+            const std::uint64_t first = head > EVENTS_PER_THREAD ? head - EVENTS_PER_THREAD : 0;
+            for (std::uint64_t i = first; i < head; ++i) {
+                const Event& e = b->events[i % EVENTS_PER_THREAD];
+                const std::uint64_t seq = e.seq.load(std::memory_order_acquire);
+                const char* name = e.name.load(std::memory_order_relaxed);
+                const std::int64_t start = e.start.load(std::memory_order_relaxed);
+                const std::int64_t duration = e.duration.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (seq != 2 * i + 2 || e.seq.load(std::memory_order_relaxed) != seq) continue;
+
+                out << ",{\"name\":\"";
+                writeEscaped(out, name);
+                out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << b->lane << ",\"ts\":" << start / 1000 << "."
+                    << padded(start % 1000) << ",\"dur\":" << duration / 1000 << "." << padded(duration % 1000) << "}";
+                ++written;
+            }
+        }
+        out << "]}\n";
+
+        std::cout << "Trace written to " << filename << std::endl;
+        return static_cast<bool>(out);
+    }
+
+private:
+    struct Event {
+        std::atomic<std::uint64_t> seq{ 0 };
+        std::atomic<const char*> name{ nullptr };
+        std::atomic<std::int64_t> start{ 0 };
+        std::atomic<std::int64_t> duration{ 0 };
+    };
+
+    // single writer: the thread currently holding it
+    struct Buffer {
+        std::array<Event, EVENTS_PER_THREAD> events;
+        std::atomic<std::uint64_t> head{ 0 };
+        unsigned lane = 0;
+    };
+
+    // Parallel::forEach starts threads of its own when its pool is busy, so buffers are leased
+    // per thread and handed back when it exits instead of growing one per thread ever started.
+    // A reused buffer keeps its lane, which then shows threads that never overlapped in time.
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Buffer>> all;
+        std::vector<Buffer*> free;
+    };
+
+    struct Lease {
+        Buffer* buffer = nullptr;
+
+        Lease() {
+            std::lock_guard<std::mutex> lock(registry().mutex);
+            auto& r = registry();
+            if (!r.free.empty()) {
+                buffer = r.free.back();
+                r.free.pop_back();
+                return;
+            }
+            r.all.push_back(std::make_unique<Buffer>());
+            buffer = r.all.back().get();
+            buffer->lane = static_cast<unsigned>(r.all.size() - 1);
+        }
+
+        ~Lease() {
+            std::lock_guard<std::mutex> lock(registry().mutex);
+            registry().free.push_back(buffer);
+        }
+    };
+
+    static Registry& registry() {
+        static Registry r;
+        return r;
+    }
+
+    static Lease& localBuffer() {
+        thread_local Lease lease;
+        return lease;
+    }
+
+    static std::chrono::steady_clock::time_point epoch() {
+        static const auto start = std::chrono::steady_clock::now();
+        return start;
+    }
+
+    static std::string padded(std::int64_t ns) {
+        std::string s = std::to_string(ns);
+        return std::string(3 - s.size(), '0') + s;
+    }
+
+    static void writeEscaped(std::ostream& out, const char* s) {
+        for (; s && *s; ++s) {
+            if (*s == '"' || *s == '\\') out << '\\';
+            out << *s;
+        }
+    }
+#else
+    static bool writeJson(const std::string&) {
+        std::cerr << "Tracing is compiled out, build with ENABLE_TRACING=1" << std::endl;
+        return false;
+    }
+#endif
+};
+
+#if ENABLE_TRACING
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name(name), start(Trace::now()) {}
+    ~TraceScope() { Trace::record(name, start, Trace::now()); }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    std::int64_t start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) do {} while (0)
+#endif
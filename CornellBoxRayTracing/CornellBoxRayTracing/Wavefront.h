@@ -0,0 +1,120 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+// Queues and bookkeeping of the wavefront (breadth-first) Whitted renderer.
+// Rays are stored as structure of arrays so every stage streams through the
+// fields it needs and nothing else.
+
+struct RayQueue {
+    std::vector<glm::vec3> origin;
+    std::vector<glm::vec3> direction;
+    std::vector<float> environmentIor;
+    std::vector<int> node;
+
+    size_t size() const { return node.size(); }
+
+    void clear() {
+        origin.clear();
+        direction.clear();
+        environmentIor.clear();
+        node.clear();
+    }
+
+    void push(const glm::vec3& o, const glm::vec3& d, float ior, int nodeIndex) {
+        origin.push_back(o);
+        direction.push_back(d);
+        environmentIor.push_back(ior);
+        node.push_back(nodeIndex);
+    }
+};
+
+struct ShadowQueue {
+    std::vector<glm::vec3> point;
+    std::vector<glm::vec3> normal;
+    std::vector<glm::vec3> direction;
+    std::vector<float> maxDist;
+    std::vector<glm::vec3> contribution;
+    std::vector<int> node;
+
+    size_t size() const { return node.size(); }
+
+    void clear() {
+        point.clear();
+        normal.clear();
+        direction.clear();
+        maxDist.clear();
+        contribution.clear();
+        node.clear();
+    }
+
+    void push(const glm::vec3& p, const glm::vec3& n, const glm::vec3& d, float dist, const glm::vec3& c, int nodeIndex) {
+        point.push_back(p);
+        normal.push_back(n);
+        direction.push_back(d);
+        maxDist.push_back(dist);
+        contribution.push_back(c);
+        node.push_back(nodeIndex);
+    }
+
+    void append(const ShadowQueue& other) {
+        point.insert(point.end(), other.point.begin(), other.point.end());
+        normal.insert(normal.end(), other.normal.begin(), other.normal.end());
+        direction.insert(direction.end(), other.direction.begin(), other.direction.end());
+        maxDist.insert(maxDist.end(), other.maxDist.begin(), other.maxDist.end());
+        contribution.insert(contribution.end(), other.contribution.begin(), other.contribution.end());
+        node.insert(node.end(), other.node.begin(), other.node.end());
+    }
+};
+
+// What a hit turned out to be; shading runs over hits grouped by kind
+enum class WaveKind : std::uint8_t {
+    Background,
+    Emitter,
+    Diffuse,
+    Mirror,
+    Glass,
+    Count
+};
+
+// One traceRay() call of the recursive tracer. Children are always created after their
+// parent, so resolving nodes from the last wave back to the first sees every child
+// before the node that combines it.
+struct WaveNode {
+    int parent = -1;
+    bool refractionChild = false;
+    WaveKind kind = WaveKind::Background;
+
+    std::uint32_t pixelX = 0;
+    std::uint32_t pixelY = 0;
+    std::uint32_t sample = 0;
+    int depth = 0;
+
+    glm::vec3 direct{ 0.0f };
+    glm::vec3 area{ 0.0f };
+    glm::vec3 tint{ 1.0f };
+    float reflectWeight = 0.0f;
+    float transparency = 0.0f;
+    bool canRefract = false;
+
+    glm::vec3 reflected{ 0.0f };
+    glm::vec3 refracted{ 0.0f };
+    glm::vec3 value{ 0.0f };
+};
+
+struct WavefrontStats {
+    double generateMs = 0.0;
+    double intersectMs = 0.0;
+    double sortMs = 0.0;
+    double shadeMs = 0.0;
+    double shadowMs = 0.0;
+    double resolveMs = 0.0;
+    size_t waves = 0;
+    size_t rays = 0;
+    size_t shadowRays = 0;
+
+    double totalMs() const {
+        return generateMs + intersectMs + sortMs + shadeMs + shadowMs + resolveMs;
+    }
+};